@@ -0,0 +1,143 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <sys/resource.h>
+#include "../mcts/include/mcts.h"
+#include "quoridor_positions.h"
+
+/** Macrobenchmark: MCTS_tree::grow_tree on a fixed set of Quoridor positions (reached by seeded random play)
+ * for every search mode. Each position gets its own tree grown for a fixed number of iterations (not time).
+ * Reports iterations per second, the size of the trees, the peak memory of their node arenas and of the trees as accounted
+ * by MCTS_tree::get_memory_usage() (one setup prunes its trees to a memory budget, one only keeps states at checkpoints, one widens its nodes progressively, one uses RAVE,
+ * one evaluates its leaves in batches with Quoridor_linear_evaluator instead of rolling them out), the latency of advancing them to their best move,
+ * how late grow_tree() stops for short time budgets, how long it takes to save a tree as an opening book and to start a new
+ * tree from it, and finally the peak resident memory of the whole process.
+ * Output is one line of key=value pairs per measurement. */
+
+#define GAMES 4
+#define MAX_PLIES 30
+#define POSITION_STRIDE 15                 // benchmark every 15th position
+#define ITERATIONS 400
+#define THREADS 2                          // for the parallel modes
+#define SEARCH_SEED 777
+#define DEADLINE_RUNS 10                   // per time budget
+#define MEMORY_BUDGET (128 * 1024)         // for the pruned setup (about half of what its largest trees use otherwise)
+#define CHECKPOINT_INTERVAL 3              // for the checkpointed setup
+#define BOOK_ITERATIONS 5000               // the tree saved as an opening book
+#define BOOK_DEPTH 3
+#define BOOK_PATH "mcts_bench.book"        // (removed afterwards)
+
+
+using namespace std;
+
+
+struct Setup {
+    const char *name;
+    unsigned int threads;
+    search_mode mode;
+    bool transpositions;
+    unsigned long memory_budget;
+    unsigned int checkpoint_interval;
+    bool widening;
+    bool rave;
+    bool evaluator;
+};
+
+
+int main() {
+    vector<Quoridor_state *> positions = generate_positions(GAMES, MAX_PLIES);
+    Setup setups[] = {
+        {"serial", 1, SERIAL_SEARCH, false, 0, 1, false, false, false},
+        {"serial_transpositions", 1, SERIAL_SEARCH, true, 0, 1, false, false, false},
+        {"serial_pruned", 1, SERIAL_SEARCH, false, MEMORY_BUDGET, 1, false, false, false},
+        {"serial_checkpoints", 1, SERIAL_SEARCH, false, 0, CHECKPOINT_INTERVAL, false, false, false},
+        {"serial_widening", 1, SERIAL_SEARCH, false, 0, 1, true, false, false},
+        {"serial_rave", 1, SERIAL_SEARCH, false, 0, 1, false, true, false},
+        {"serial_evaluator", 1, SERIAL_SEARCH, false, 0, 1, false, false, true},
+        {"tree_parallel", THREADS, TREE_PARALLEL_SEARCH, false, 0, 1, false, false, false},
+        {"root_parallel", THREADS, ROOT_PARALLEL_SEARCH, false, 0, 1, false, false, false},
+        {"pipelined", THREADS, PIPELINED_SEARCH, false, 0, 1, false, false, false}
+    };
+    Quoridor_linear_evaluator evaluator;
+    cout << fixed << setprecision(0);
+    for (const Setup &setup : setups) {
+        unsigned long trees = 0, nodes = 0, peak_node_memory = 0, peak_tree_memory = 0;
+        double seconds = 0.0, advance_seconds = 0.0;
+        for (size_t i = 0 ; i < positions.size() ; i += POSITION_STRIDE) {
+            MCTS_tree tree(new Quoridor_state(*positions[i]), setup.transpositions);
+            tree.seed(SEARCH_SEED);
+            tree.set_memory_budget(setup.memory_budget);
+            tree.set_checkpoints(setup.checkpoint_interval);
+            if (setup.widening) tree.set_progressive_widening();
+            if (setup.rave) tree.set_rave();
+            if (setup.evaluator) tree.set_leaf_evaluator(&evaluator);
+            // (!) grow_tree() prints its progress in DEBUG builds: keep it out of our output
+            ostringstream discarded;
+            streambuf *cout_buffer = cout.rdbuf(discarded.rdbuf());
+            auto start = chrono::steady_clock::now();
+            tree.grow_tree(ITERATIONS, 1e9, setup.threads, setup.mode);
+            seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout.rdbuf(cout_buffer);
+            trees++;
+            nodes += tree.get_size();
+            peak_node_memory = max(peak_node_memory, tree.get_node_memory());
+            peak_tree_memory = max(peak_tree_memory, tree.get_memory_usage());
+            start = chrono::steady_clock::now();
+            tree.advance_tree(tree.select_best_child()->get_move());
+            advance_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+        cout << "bench=mcts measure=grow_tree setup=" << setup.name << " threads=" << setup.threads << " trees=" << trees
+             << " iterations_per_sec=" << setprecision(1) << trees * ITERATIONS / seconds << setprecision(0)
+             << " mean_nodes=" << nodes / trees << " peak_node_bytes=" << peak_node_memory << " peak_tree_bytes=" << peak_tree_memory
+             << setprecision(3) << " mean_advance_ms=" << advance_seconds / trees * 1000 << setprecision(0) << endl;
+    }
+    // deadline precision: how long grow_tree() takes past its time budget (serial search on the first position)
+    double budgets[] = {0.01, 0.05, 0.2};
+    for (double budget : budgets) {
+        double worst = 0.0, total = 0.0;
+        for (int r = 0 ; r < DEADLINE_RUNS ; r++) {
+            MCTS_tree tree(new Quoridor_state(*positions[0]));
+            tree.seed(SEARCH_SEED + r);
+            ostringstream discarded;
+            streambuf *cout_buffer = cout.rdbuf(discarded.rdbuf());
+            auto start = chrono::steady_clock::now();
+            tree.grow_tree(1000000, budget, 1, SERIAL_SEARCH);
+            double late = chrono::duration<double>(chrono::steady_clock::now() - start).count() - budget;
+            cout.rdbuf(cout_buffer);
+            worst = max(worst, late);
+            total += late;
+        }
+        cout << "bench=mcts measure=deadline budget_ms=" << budget * 1000 << setprecision(3)
+             << " mean_overshoot_ms=" << total / DEADLINE_RUNS * 1000 << " max_overshoot_ms=" << worst * 1000 << setprecision(0) << endl;
+    }
+    // opening book: save the tree of the first position and seed a new tree from it
+    {
+        MCTS_tree tree(new Quoridor_state(*positions[0]));
+        tree.seed(SEARCH_SEED);
+        ostringstream discarded;
+        streambuf *cout_buffer = cout.rdbuf(discarded.rdbuf());
+        tree.grow_tree(BOOK_ITERATIONS, 1e9, 1, SERIAL_SEARCH);
+        auto start = chrono::steady_clock::now();
+        tree.save_book(BOOK_PATH, BOOK_DEPTH);
+        double save_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        start = chrono::steady_clock::now();
+        MCTS_book book;
+        book.open(BOOK_PATH);
+        MCTS_tree seeded(new Quoridor_state(*positions[0]));
+        unsigned int added = seeded.load_book(book);
+        double load_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout.rdbuf(cout_buffer);
+        cout << "bench=mcts measure=book depth=" << BOOK_DEPTH << " records=" << book.size() << " nodes_added=" << added
+             << setprecision(3) << " save_ms=" << save_seconds * 1000 << " load_ms=" << load_seconds * 1000 << setprecision(0) << endl;
+        book.close();
+        remove(BOOK_PATH);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    cout << "bench=mcts measure=memory peak_rss_kb=" << usage.ru_maxrss << endl;
+    for (Quoridor_state *s : positions) delete s;
+    return 0;
+}
@@ -0,0 +1,231 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include "../mcts/include/mcts.h"
+#include "../examples/Quoridor/Quoridor.h"
+
+/** Headless self-play arena: games of Quoridor between two engine configurations A and B, one game per job on a
+ * JobScheduler with a thread per core. A plays white in even games and black in odd ones. Every engine searches serially
+ * with its rollouts on its own thread (see MCTS_tree::set_rollouts_per_leaf) so that concurrent games don't share a pool.
+ * Reports A's score (wins plus half the draws) with a 95% confidence interval and the Elo difference that it implies, and
+ * for each engine its iterations per second and its mean think time and CPU time per move, i.e. what its strength costs.
+ *
+ * Usage: quoridor_arena [games=N] [threads=N] [seed=N] [max_plies=N] [a.<key>=<value>] [b.<key>=<value>]
+ * with the engine keys iterations, seconds (per move), c (exploration constant), rollouts (per leaf), moves (all or good)
+ * and evaluator (1 for Quoridor_linear_evaluator instead of rollouts). Games that reach max_plies are draws.
+ * Output is one line of key=value pairs per engine and one for the match. */
+
+#define GAMES 100
+#define MAX_PLIES 200
+#define ARENA_SEED 1
+#define Z95 1.959964                       // normal quantile of a 95% two-sided confidence interval
+
+
+using namespace std;
+
+
+struct Engine {
+    int iterations;
+    double seconds;
+    double c;
+    unsigned int rollouts;
+    bool all_moves;
+    bool evaluator;
+    Engine() : iterations(2000), seconds(1.0), c(EXPLORATION_CONSTANT), rollouts(ROLLOUTS_PER_ITERATION), all_moves(true),
+               evaluator(false) {}
+    bool set(const string &key, const string &value);
+    string describe() const;
+};
+
+struct Tally {                             // what an engine did in one game
+    unsigned long moves, iterations;
+    double think_seconds, cpu_seconds;
+    Tally() : moves(0), iterations(0), think_seconds(0.0), cpu_seconds(0.0) {}
+    void add(const Tally &o) { moves += o.moves; iterations += o.iterations; think_seconds += o.think_seconds; cpu_seconds += o.cpu_seconds; }
+};
+
+struct Game {
+    double a_score;                        // 1 if A won, 0 if B won, 0.5 for a draw
+    unsigned int plies;
+    Tally tally[2];                        // A's, B's
+};
+
+
+bool Engine::set(const string &key, const string &value) {
+    istringstream in(value);
+    if (key == "iterations") in >> iterations;
+    else if (key == "seconds") in >> seconds;
+    else if (key == "c") in >> c;
+    else if (key == "rollouts") in >> rollouts;
+    else if (key == "evaluator") in >> evaluator;
+    else if (key == "moves") {
+        if (value != "all" && value != "good") return false;
+        all_moves = value == "all";
+        return true;
+    }
+    else return false;
+    return !in.fail();
+}
+
+string Engine::describe() const {
+    ostringstream out;
+    out << "iterations=" << iterations << " seconds=" << seconds << " c=" << c << " rollouts=" << rollouts
+        << " moves=" << (all_moves ? "all" : "good") << " evaluator=" << evaluator;
+    return out.str();
+}
+
+
+static double cpu_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const Quoridor_linear_evaluator evaluator;    // (thread-safe: shared by all trees)
+
+static void play(const Engine *engines[2], unsigned int a_color, unsigned long long seed, unsigned int max_plies, Game &game) {
+    /** One game: engines[0] is A which plays white if a_color is 0. Each engine keeps its own tree for the whole game. */
+    Quoridor_state state;
+    MCTS_tree *trees[2];
+    for (int e = 0 ; e < 2 ; e++) {
+        Quoridor_state *root = new Quoridor_state();
+        root->set_test_all_moves(engines[e]->all_moves);
+        trees[e] = new MCTS_tree(root);
+        trees[e]->seed(seed * 2 + e);
+        trees[e]->set_quiet(true);         // (!) the search prints its progress in DEBUG builds: keep it out of our output
+        trees[e]->set_exploration(engines[e]->c);
+        trees[e]->set_rollouts_per_leaf(engines[e]->rollouts);
+        if (engines[e]->evaluator) trees[e]->set_leaf_evaluator(&evaluator);
+    }
+    game.plies = 0;
+    while (game.plies < max_plies && !state.is_terminal()) {
+        unsigned int e = (state.whose_turn() == 'W') == (a_color == 0) ? 0 : 1;
+        auto started = chrono::steady_clock::now();
+        double cpu_started = cpu_time();
+        int iterations = trees[e]->grow_tree(engines[e]->iterations, engines[e]->seconds, 1, SERIAL_SEARCH);
+        MCTS_node *best = trees[e]->select_best_child();
+        Tally &t = game.tally[e];
+        t.moves++;
+        t.iterations += iterations;
+        t.think_seconds += chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        t.cpu_seconds += cpu_time() - cpu_started;
+        if (best == NULL) {                // should not happen
+            cerr << "Warning: Engine " << (e == 0 ? 'A' : 'B') << " found no move" << endl;
+            break;
+        }
+        Quoridor_move move(*(const Quoridor_move *) best->get_move());     // (a copy: advancing the trees frees it)
+        if (!state.play_move(&move)) {
+            cerr << "Warning: Engine " << (e == 0 ? 'A' : 'B') << " generated an illegal move: " << move.sprint() << endl;
+            break;
+        }
+        trees[0]->advance_tree(&move);
+        trees[1]->advance_tree(&move);
+        game.plies++;
+    }
+    char winner = state.check_winner();
+    char a_side = (a_color == 0) ? 'W' : 'B';
+    game.a_score = (winner == ' ') ? 0.5 : (winner == a_side) ? 1.0 : 0.0;
+    delete trees[0];
+    delete trees[1];
+}
+
+
+class GameJob : public Job {
+    const Engine **engines;
+    unsigned int index, max_plies;
+    unsigned long long seed;
+    Game *game;
+public:
+    GameJob(const Engine **engines, unsigned int index, unsigned long long seed, unsigned int max_plies, Game *game)
+        : Job(), engines(engines), index(index), max_plies(max_plies), seed(seed), game(game) {}
+    void run() override { play(engines, index % 2, seed, max_plies, *game); }
+};
+
+
+static double elo(double score) {
+    /** Elo difference of a player that scores score against its opponent (infinite at 0 and 1) */
+    if (score <= 0.0) return -INFINITY;
+    if (score >= 1.0) return INFINITY;
+    return -400.0 * log10(1.0 / score - 1.0);
+}
+
+
+int main(int argc, char **argv) {
+    unsigned int games = GAMES, max_plies = MAX_PLIES;
+    unsigned int threads = thread::hardware_concurrency();
+    unsigned long long seed = ARENA_SEED;
+    Engine a, b;
+    for (int i = 1 ; i < argc ; i++) {
+        string arg = argv[i];
+        size_t eq = arg.find('=');
+        string key = arg.substr(0, eq), value = (eq == string::npos) ? "" : arg.substr(eq + 1);
+        istringstream in(value);
+        bool ok;
+        if (eq == string::npos) ok = false;
+        else if (key == "games") ok = !(in >> games).fail();
+        else if (key == "threads") ok = !(in >> threads).fail();
+        else if (key == "seed") ok = !(in >> seed).fail();
+        else if (key == "max_plies") ok = !(in >> max_plies).fail();
+        else if (key.compare(0, 2, "a.") == 0) ok = a.set(key.substr(2), value);
+        else if (key.compare(0, 2, "b.") == 0) ok = b.set(key.substr(2), value);
+        else ok = false;
+        if (!ok) {
+            cerr << "Invalid argument: " << arg << endl
+                 << "Usage: " << argv[0] << " [games=N] [threads=N] [seed=N] [max_plies=N] [a.<key>=<value>] [b.<key>=<value>]" << endl
+                 << "  engine keys: iterations, seconds, c, rollouts, moves (all or good), evaluator (0 or 1)" << endl;
+            return 1;
+        }
+    }
+    if (threads == 0) threads = 1;
+    cout << fixed;
+
+    const Engine *engines[2] = {&a, &b};
+    vector<Game> results(games);
+    auto started = chrono::steady_clock::now();
+    {
+        JobScheduler scheduler(threads);
+        for (unsigned int g = 0 ; g < games ; g++) {
+            scheduler.schedule(new GameJob(engines, g, seed * 1000003ULL + g, max_plies, &results[g]));
+        }
+        scheduler.waitUntilJobsHaveFinished();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    // the match: A's mean score over the games and its standard error
+    unsigned int a_wins = 0, b_wins = 0, draws = 0;
+    double sum = 0.0, sum_of_squares = 0.0, plies = 0.0;
+    Tally tally[2];
+    for (const Game &game : results) {
+        if (game.a_score == 1.0) a_wins++;
+        else if (game.a_score == 0.0) b_wins++;
+        else draws++;
+        sum += game.a_score;
+        sum_of_squares += game.a_score * game.a_score;
+        plies += game.plies;
+        tally[0].add(game.tally[0]);
+        tally[1].add(game.tally[1]);
+    }
+    double score = (games > 0) ? sum / games : 0.5;
+    double variance = (games > 1) ? (sum_of_squares - games * score * score) / (games - 1) : 0.25;
+    double margin = Z95 * sqrt(max(variance, 0.0) / max(games, 1u));
+    double low = max(score - margin, 0.0), high = min(score + margin, 1.0);
+    for (int e = 0 ; e < 2 ; e++) {
+        const Tally &t = tally[e];
+        double per_move = (t.moves > 0) ? 1.0 / t.moves : 0.0;
+        cout << "arena=quoridor engine=" << (e == 0 ? 'a' : 'b') << " " << engines[e]->describe() << " moves_played=" << t.moves
+            << setprecision(1) << " iterations_per_sec=" << ((t.think_seconds > 0.0) ? t.iterations / t.think_seconds : 0.0)
+            << setprecision(3) << " mean_think_ms=" << t.think_seconds * per_move * 1000
+            << " cpu_seconds_per_move=" << t.cpu_seconds * per_move << " cpu_seconds=" << t.cpu_seconds << endl;
+    }
+    cout << "arena=quoridor games=" << games << " threads=" << threads << " a_wins=" << a_wins << " b_wins=" << b_wins
+        << " draws=" << draws << setprecision(3) << " a_score=" << score << " ci95_low=" << low << " ci95_high=" << high
+        << setprecision(1) << " elo=" << elo(score) << " elo_low=" << elo(low) << " elo_high=" << elo(high)
+        << " mean_plies=" << ((games > 0) ? plies / games : 0.0) << " seconds=" << seconds << endl;
+    return 0;
+}
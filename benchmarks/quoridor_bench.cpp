@@ -0,0 +1,150 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include "quoridor_positions.h"
+
+/** Benchmark of the Quoridor engine on a fixed set of positions (reached by seeded random play):
+ * - shortest path calls per second with every possible extra wall (the ones without are lookups in the distance fields)
+ * - latency of generate_all_moves() and generate_good_moves()
+ * - rollouts per second, one at a time and in batches (MCTS_state::rollout_batch)
+ * - leaf evaluations per second in batches (Quoridor_linear_evaluator), the cheap alternative to rollouts
+ * - a checksum of the legal moves and shortest paths of every position, which must not change when
+ *   the engine is optimized (compare the output of two builds)
+ * Output is one line of key=value pairs per measurement. */
+
+#define GAMES 20
+#define MAX_PLIES 40
+#define BFS_ROUNDS 20
+#define MOVEGEN_ROUNDS 5
+#define ROLLOUT_SECONDS 5.0
+#define ROLLOUT_SEED 2024
+#define ROLLOUT_BATCH 4
+#define EVALUATION_SECONDS 2.0
+#define EVALUATION_BATCH 16                // (as MCTS_tree by default)
+
+
+using namespace std;
+
+
+unsigned long long checksum(const vector<Quoridor_state *> &positions) {
+    unsigned long long sum = 0;
+    for (Quoridor_state *position : positions) {
+        Quoridor_state s(*position);
+        sum = sum * 31 + s.get_shortest_path('W');
+        sum = sum * 31 + s.get_shortest_path('B');
+        queue<MCTS_move *> *moves = s.generate_all_moves();
+        while (!moves->empty()) {
+            Quoridor_move *m = (Quoridor_move *) moves->front();
+            for (char c : m->sprint()) sum = sum * 31 + c;
+            if (m->type == 'h' || m->type == 'v') {
+                sum = sum * 31 + s.get_shortest_path('W', m);
+                sum = sum * 31 + s.get_shortest_path('B', m);
+            }
+            delete moves->front();
+            moves->pop();
+        }
+        delete moves;
+    }
+    return sum;
+}
+
+
+int main() {
+    vector<Quoridor_state *> positions = generate_positions(GAMES, MAX_PLIES);
+    cout << fixed << setprecision(0);
+    cout << "bench=quoridor positions=" << positions.size() << " checksum=" << checksum(positions) << endl;
+    // shortest paths if one of the legal walls was placed
+    vector<vector<Quoridor_move> > walls(positions.size());
+    for (size_t i = 0 ; i < positions.size() ; i++) {
+        queue<MCTS_move *> *moves = positions[i]->generate_all_moves();
+        while (!moves->empty()) {
+            Quoridor_move *m = (Quoridor_move *) moves->front();
+            if (m->type == 'h' || m->type == 'v') walls[i].push_back(*m);
+            delete m;
+            moves->pop();
+        }
+        delete moves;
+    }
+    unsigned long calls = 0;
+    long total = 0;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0 ; r < BFS_ROUNDS ; r++) {
+        for (size_t i = 0 ; i < positions.size() ; i++) {
+            for (const Quoridor_move &wall : walls[i]) {
+                total += positions[i]->get_shortest_path((r % 2) ? 'W' : 'B', &wall);
+                calls++;
+            }
+        }
+    }
+    double dt = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "bench=quoridor measure=shortest_path calls=" << calls << " calls_per_sec=" << calls / dt << " sum=" << total << endl;
+    // move generation (on copies of the positions since it may change their cached paths)
+    const char *generators[] = {"generate_all_moves", "generate_good_moves"};
+    for (int g = 0 ; g < 2 ; g++) {
+        unsigned long generated = 0;
+        double max_latency = 0.0;
+        start = chrono::steady_clock::now();
+        for (int r = 0 ; r < MOVEGEN_ROUNDS ; r++) {
+            for (Quoridor_state *position : positions) {
+                auto call_start = chrono::steady_clock::now();
+                Quoridor_state s(*position);
+                queue<MCTS_move *> *moves = (g == 0) ? s.generate_all_moves() : s.generate_good_moves();
+                max_latency = max(max_latency, chrono::duration<double>(chrono::steady_clock::now() - call_start).count());
+                generated += moves->size();
+                while (!moves->empty()) {
+                    delete moves->front();
+                    moves->pop();
+                }
+                delete moves;
+            }
+        }
+        dt = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        unsigned long calls = MOVEGEN_ROUNDS * positions.size();
+        cout << "bench=quoridor measure=" << generators[g] << " calls=" << calls << setprecision(2)
+             << " mean_latency_us=" << dt / calls * 1e6 << " max_latency_us=" << max_latency * 1e6
+             << " moves=" << generated << setprecision(0) << endl;
+    }
+    // rollouts
+    unsigned long rollouts = 0;
+    MCTS_rng rng(ROLLOUT_SEED);
+    start = chrono::steady_clock::now();
+    do {
+        positions[rollouts % positions.size()]->rollout(rng);
+        rollouts++;
+        dt = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    } while (dt < ROLLOUT_SECONDS);
+    cout << "bench=quoridor measure=rollout rollouts=" << rollouts << " rollouts_per_sec=" << setprecision(1) << rollouts / dt << endl;
+    // the same in batches (one per position at a time)
+    MCTS_rng rngs[ROLLOUT_BATCH];
+    double results[ROLLOUT_BATCH];
+    rollouts = 0;
+    rng = MCTS_rng(ROLLOUT_SEED);
+    start = chrono::steady_clock::now();
+    do {
+        for (int i = 0 ; i < ROLLOUT_BATCH ; i++) rngs[i] = rng.split();
+        positions[(rollouts / ROLLOUT_BATCH) % positions.size()]->rollout_batch(ROLLOUT_BATCH, rngs, results, NULL);
+        rollouts += ROLLOUT_BATCH;
+        dt = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    } while (dt < ROLLOUT_SECONDS);
+    cout << "bench=quoridor measure=rollout_batch batch=" << ROLLOUT_BATCH << " rollouts=" << rollouts
+         << " rollouts_per_sec=" << setprecision(1) << rollouts / dt << endl;
+    // leaf evaluations in batches of EVALUATION_BATCH positions
+    Quoridor_linear_evaluator evaluator;
+    vector<const MCTS_state *> batch(EVALUATION_BATCH);
+    vector<double> values(EVALUATION_BATCH);
+    unsigned long evaluations = 0;
+    double sum = 0.0;
+    start = chrono::steady_clock::now();
+    do {
+        for (unsigned int i = 0 ; i < EVALUATION_BATCH ; i++) batch[i] = positions[(evaluations + i) % positions.size()];
+        evaluator.evaluate(batch.data(), EVALUATION_BATCH, values.data());
+        for (double v : values) sum += v;
+        evaluations += EVALUATION_BATCH;
+        dt = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    } while (dt < EVALUATION_SECONDS);
+    cout << "bench=quoridor measure=evaluate batch=" << EVALUATION_BATCH << " evaluations=" << evaluations
+         << " evaluations_per_sec=" << setprecision(1) << evaluations / dt << " mean_value=" << setprecision(4) << sum / evaluations << endl;
+    for (Quoridor_state *s : positions) delete s;
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef MCTS_QUORIDOR_POSITIONS_H
+#define MCTS_QUORIDOR_POSITIONS_H
+
+#include <random>
+#include <vector>
+#include "../examples/Quoridor/Quoridor.h"
+
+/** Fixed set of Quoridor positions for the benchmarks: every position of a few games of random play.
+ * The games only depend on the seed so that every build gets measured on the same positions. */
+
+#define POSITIONS_SEED 12345
+
+
+inline std::vector<Quoridor_state *> generate_positions(int games, int max_plies, unsigned int seed = POSITIONS_SEED) {
+    std::vector<Quoridor_state *> positions;
+    std::mt19937 gen(seed);
+    for (int g = 0 ; g < games ; g++) {
+        Quoridor_state s;
+        for (int ply = 0 ; ply < max_plies && !s.is_terminal() ; ply++) {
+            queue<MCTS_move *> *moves = s.generate_all_moves();
+            unsigned int pick = gen() % moves->size(), i = 0;
+            Quoridor_move *chosen = NULL;
+            while (!moves->empty()) {
+                MCTS_move *m = moves->front();
+                moves->pop();
+                if (i++ == pick) chosen = (Quoridor_move *) m;
+                else delete m;
+            }
+            delete moves;
+            s.play_move(chosen);
+            delete chosen;
+            positions.push_back(new Quoridor_state(s));
+        }
+    }
+    return positions;
+}
+
+
+#endif
@@ -0,0 +1,101 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include "../mcts/include/JobScheduler.h"
+#include "../mcts/include/WorkStealingScheduler.h"
+
+/** Microbenchmark: JobScheduler vs WorkStealingScheduler on empty and tiny jobs for 1-64 threads.
+ * Two patterns are measured:
+ * - throughput: many jobs scheduled at once (in batches for the work-stealing scheduler) and a single wait
+ * - roundtrip:  the MCTS pattern of scheduling as many jobs as threads and waiting for them before the next batch
+ * Output is one line of key=value pairs per measurement. */
+
+#define THROUGHPUT_JOBS 200000
+#define ROUNDTRIPS 5000
+#define BATCH_SIZE 64
+#define TINY_JOB_ITERATIONS 1000        // roughly a microsecond of work
+
+
+using namespace std;
+
+
+class BenchJob : public Job {
+    unsigned int work;
+public:
+    volatile unsigned long result;
+    explicit BenchJob(unsigned int work = 0) : Job(), work(work), result(0) {}
+    void run() override {
+        unsigned long x = 0;
+        for (unsigned int i = 0 ; i < work ; i++) x += i * i;
+        result = x;
+    }
+};
+
+
+double throughput_old(unsigned int threads, unsigned int work) {
+    JobScheduler scheduler(threads);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0 ; i < THROUGHPUT_JOBS ; i++) {
+        scheduler.schedule(new BenchJob(work));      // (!) JobScheduler deletes its jobs
+    }
+    scheduler.waitUntilJobsHaveFinished();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+double throughput_new(unsigned int threads, unsigned int work) {
+    WorkStealingScheduler scheduler(threads);
+    vector<BenchJob> jobs(THROUGHPUT_JOBS, BenchJob(work));
+    vector<Job *> ptrs(THROUGHPUT_JOBS);
+    for (int i = 0 ; i < THROUGHPUT_JOBS ; i++) ptrs[i] = &jobs[i];
+    auto start = chrono::steady_clock::now();
+    for (int i = 0 ; i < THROUGHPUT_JOBS ; i += BATCH_SIZE) {
+        scheduler.schedule_batch(&ptrs[i], (THROUGHPUT_JOBS - i < BATCH_SIZE) ? THROUGHPUT_JOBS - i : BATCH_SIZE);
+    }
+    scheduler.waitUntilJobsHaveFinished();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+double roundtrip_old(unsigned int threads, unsigned int work) {
+    JobScheduler scheduler(threads);
+    auto start = chrono::steady_clock::now();
+    for (int r = 0 ; r < ROUNDTRIPS ; r++) {
+        for (unsigned int i = 0 ; i < threads ; i++) {
+            scheduler.schedule(new BenchJob(work));
+        }
+        scheduler.waitUntilJobsHaveFinished();
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+double roundtrip_new(unsigned int threads, unsigned int work) {
+    WorkStealingScheduler scheduler(threads);
+    vector<BenchJob> jobs(threads, BenchJob(work));
+    vector<Job *> ptrs(threads);
+    for (unsigned int i = 0 ; i < threads ; i++) ptrs[i] = &jobs[i];
+    auto start = chrono::steady_clock::now();
+    for (int r = 0 ; r < ROUNDTRIPS ; r++) {
+        scheduler.schedule_batch(&ptrs[0], threads);
+        scheduler.waitUntilJobsHaveFinished();
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+
+int main() {
+    unsigned int thread_counts[] = {1, 2, 4, 8, 16, 32, 64};
+    unsigned int works[] = {0, TINY_JOB_ITERATIONS};
+    cout << fixed << setprecision(0);
+    for (unsigned int work : works) {
+        const char *job = (work == 0) ? "empty" : "tiny";
+        for (unsigned int threads : thread_counts) {
+            double t_old = throughput_old(threads, work), t_new = throughput_new(threads, work);
+            cout << "bench=scheduler pattern=throughput job=" << job << " threads=" << threads
+                 << " old_jobs_per_sec=" << THROUGHPUT_JOBS / t_old << " new_jobs_per_sec=" << THROUGHPUT_JOBS / t_new << endl;
+            double r_old = roundtrip_old(threads, work), r_new = roundtrip_new(threads, work);
+            cout << "bench=scheduler pattern=roundtrip job=" << job << " threads=" << threads
+                 << " old_batches_per_sec=" << ROUNDTRIPS / r_old << " new_batches_per_sec=" << ROUNDTRIPS / r_new << endl;
+        }
+    }
+    return 0;
+}
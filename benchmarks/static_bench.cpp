@@ -0,0 +1,93 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include "../mcts/include/mcts_static.h"
+#include "../examples/TicTacToe/TicTacToe.h"
+#include "quoridor_positions.h"
+
+/** Benchmark of devirtualization: serial search with
+ * - MCTS_tree (virtual calls on heap states and moves; NUMBER_OF_THREADS rollouts per iteration if PARALLEL_ROLLOUTS is defined)
+ * - MCTS_static_tree over the MCTS_virtual_state adapter (the same engine, virtual calls)
+ * - MCTS_static_tree over the game's own classes (direct calls, states and moves by value)
+ * on the empty TicTacToe board and on fixed Quoridor positions. The last two only differ in how the game is called.
+ * Output is one line of key=value pairs per measurement. */
+
+#define TICTACTOE_ITERATIONS 100000
+#define QUORIDOR_GAMES 4
+#define QUORIDOR_MAX_PLIES 30
+#define QUORIDOR_STRIDE 15
+#define QUORIDOR_ITERATIONS 400
+#define SEARCH_SEED 777
+
+
+using namespace std;
+
+
+struct Result {
+    double seconds;
+    unsigned long iterations;
+    Result() : seconds(0.0), iterations(0) {}
+};
+
+
+template <class S>
+void search_dynamic(const S &position, int iterations, Result &result) {
+    MCTS_tree tree(new S(position));
+    tree.seed(SEARCH_SEED);
+    // (!) grow_tree() prints its progress in DEBUG builds: keep it out of our output
+    ostringstream discarded;
+    streambuf *cout_buffer = cout.rdbuf(discarded.rdbuf());
+    auto start = chrono::steady_clock::now();
+    result.iterations += tree.grow_tree(iterations, 1e9, 1, SERIAL_SEARCH);
+    result.seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout.rdbuf(cout_buffer);
+}
+
+
+template <class State, class Move>
+void search_static(const State &position, int iterations, Result &result) {
+    MCTS_static_tree<State, Move> tree(position);
+    tree.seed(SEARCH_SEED);
+    auto start = chrono::steady_clock::now();
+    result.iterations += tree.grow_tree(iterations, 1e9);
+    result.seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+
+void report(const char *game, const char *engine, const Result &r) {
+    cout << "bench=static game=" << game << " engine=" << engine << " iterations=" << r.iterations
+         << " iterations_per_sec=" << setprecision(1) << r.iterations / r.seconds << setprecision(0) << endl;
+}
+
+
+int main() {
+    cout << fixed << setprecision(0);
+    // TicTacToe: the game is so cheap that the engine is most of the cost
+    {
+        TicTacToe_state empty;
+        Result dynamic, adapter, direct;
+        search_dynamic(empty, TICTACTOE_ITERATIONS, dynamic);
+        search_static<MCTS_virtual_state, MCTS_virtual_move>(MCTS_virtual_state(new TicTacToe_state(empty)), TICTACTOE_ITERATIONS, adapter);
+        search_static<TicTacToe_state, TicTacToe_move>(empty, TICTACTOE_ITERATIONS, direct);
+        report("tictactoe", "MCTS_tree", dynamic);
+        report("tictactoe", "static_virtual_adapter", adapter);
+        report("tictactoe", "static", direct);
+    }
+    // Quoridor: rollouts dominate
+    {
+        vector<Quoridor_state *> positions = generate_positions(QUORIDOR_GAMES, QUORIDOR_MAX_PLIES);
+        Result dynamic, adapter, direct;
+        for (size_t i = 0 ; i < positions.size() ; i += QUORIDOR_STRIDE) {
+            search_dynamic(*positions[i], QUORIDOR_ITERATIONS, dynamic);
+            search_static<MCTS_virtual_state, MCTS_virtual_move>(MCTS_virtual_state(positions[i]->clone()), QUORIDOR_ITERATIONS, adapter);
+            search_static<Quoridor_state, Quoridor_move>(*positions[i], QUORIDOR_ITERATIONS, direct);
+        }
+        report("quoridor", "MCTS_tree", dynamic);
+        report("quoridor", "static_virtual_adapter", adapter);
+        report("quoridor", "static", direct);
+        for (Quoridor_state *s : positions) delete s;
+    }
+    return 0;
+}
@@ -2,40 +2,66 @@
 #include <iomanip>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include "Quoridor.h"
 
 #define TEST_ALL_MOVES                          // test all moves vs just some found good by a heuristic (increases branching factor of tree but could find unexpectedly good moves)
+#ifdef TEST_ALL_MOVES                           // (the default of new states, see Quoridor_state::set_test_all_moves)
+#define ALL_MOVES_BY_DEFAULT true
+#else
+#define ALL_MOVES_BY_DEFAULT false
+#endif
 #define MAX(A, B) (((A) > (B)) ? A : B)
+#define ROW_MASK 0x1FF                          // the 9 columns of a bitboard row
 
 
 using namespace std;
 
 
-default_random_engine Quoridor_state::generator = default_random_engine(time(NULL));
+/** Zobrist keys: pawns (white then black) at each square, each wall, number of walls left (white then black) and turn */
+#define ZOBRIST_WHITE_PAWN(X, Y) ((X) * 9 + (Y))
+#define ZOBRIST_BLACK_PAWN(X, Y) (81 + (X) * 9 + (Y))
+#define ZOBRIST_WALL(X, Y, TYPE) (162 + ((X) * 8 + (Y)) * 2 + ((TYPE) == 'h' ? 0 : 1))
+#define ZOBRIST_WHITE_WALLS(N) (290 + (N))
+#define ZOBRIST_BLACK_WALLS(N) (301 + (N))
+#define ZOBRIST_BLACK_TURN 312
+#define ZOBRIST_KEYS 313
+
+const unsigned long long *Quoridor_state::zobrist_keys() {
+    static unsigned long long keys[ZOBRIST_KEYS];
+    static bool initialized = [](){
+        mt19937_64 gen(0x5eed);         // (!) fixed seed: hashes must be the same in every run and thread
+        for (int i = 0 ; i < ZOBRIST_KEYS ; i++) keys[i] = gen();
+        return true;
+    }();
+    (void) initialized;
+    return keys;
+}
 
 
 Quoridor_state::Quoridor_state()
-    : move_counter(0), wx(0), wy(4), bx(8), by(4), wwallsno(10), bwallsno(10), turn('W'), wdists(NULL), bdists(NULL) {
-    for (int i = 0 ; i < 81 ; i++) {
-        walls[i / 9][i % 9] = ' ';
-        if (i < 64) wall_connections[i / 8][i % 8] = false;
-    }
+    : move_counter(0), wx(0), wy(4), bx(8), by(4), wwallsno(10), bwallsno(10), turn('W'), wfield_valid(false), bfield_valid(false),
+      test_all_moves(ALL_MOVES_BY_DEFAULT) {
+    const unsigned long long *keys = zobrist_keys();
+    zobrist = keys[ZOBRIST_WHITE_PAWN(wx, wy)] ^ keys[ZOBRIST_BLACK_PAWN(bx, by)] ^
+              keys[ZOBRIST_WHITE_WALLS(wwallsno)] ^ keys[ZOBRIST_BLACK_WALLS(bwallsno)];
 }
 
 Quoridor_state::Quoridor_state(const Quoridor_state &other)
     : move_counter(other.move_counter), wx(other.wx), wy(other.wy), bx(other.bx), by(other.by),
       wwallsno(other.wwallsno), bwallsno(other.bwallsno), turn(other.turn),
-      wdists(NULL), bdists(NULL) {    // TODO: Is it cheaper to copy dists than to potentially recalculate them?
-    for (int i = 0 ; i < 81 ; i++) {
-        walls[i / 9][i % 9] = other.walls[i / 9][i % 9];
-        if (i < 64) wall_connections[i / 8][i % 8] = other.wall_connections[i / 8][i % 8];
+      wfield_valid(other.wfield_valid), bfield_valid(other.bfield_valid), zobrist(other.zobrist), test_all_moves(other.test_all_moves) {
+    for (int i = 0 ; i < 9 ; i++) {
+        hwalls[i] = other.hwalls[i];
+        vwalls[i] = other.vwalls[i];
+        if (i < 8) wall_connections[i] = other.wall_connections[i];
     }
+    // copying the distance fields is much cheaper than recalculating them
+    if (wfield_valid) memcpy(wfield, other.wfield, sizeof(wfield));
+    if (bfield_valid) memcpy(bfield, other.bfield, sizeof(bfield));
 }
 
-Quoridor_state::~Quoridor_state() {
-    reset_dists(wdists);
-    reset_dists(bdists);
-}
+Quoridor_state::~Quoridor_state() = default;
 
 char Quoridor_state::check_winner() const {
     if (wx == 8) return 'W';
@@ -43,247 +69,281 @@ char Quoridor_state::check_winner() const {
     return ' ';
 }
 
-short int **Quoridor_state::calculate_dists_from(short int x, short int y, bool stop_at_goal, char player) {
-    /** Important note:
-     * - stop_at_goal=true should be used when we only care about 1 square of the endzone (the minimum one)
-     * being calculated and we don't really care for the rest of the board (which is typically the case)
-     * - In that case we also need the player parameter. Otherwise it won't be used.
-     */
-    if (x < 0 || x >= 9 || y < 0 || y >= 9) {
-        cerr << "Error: Invalid coordinates in calculate_dists_from()" << endl;   // should not happen
-        return NULL;
-    }
-    // allocate space for result
-    short int **dists = new short int *[9];
+bool Quoridor_state::flood_fill_step(const unsigned short reached[9], const unsigned short hw[9], const unsigned short vw[9], unsigned short next[9]) {
+    /** Bit-parallel BFS step: grows the set of reached squares of all rows by one step at once (with shifts and masks).
+     * Returns false if nothing new was reached. */
+    bool grew = false;
     for (int i = 0 ; i < 9 ; i++) {
-        dists[i] = new short int[9];
-        for (int j = 0 ; j < 9 ; j++) {
-            dists[i][j] = -1;   // < 0 signifies unreachable squares
+        unsigned short r = reached[i];
+        unsigned int n = r | ((r & ~vw[i]) << 1) | ((r >> 1) & ~vw[i]);     // right, left
+        if (i > 0) n |= reached[i - 1] & ~hw[i - 1];                      // down from the row above
+        if (i < 8) n |= reached[i + 1] & ~hw[i];                          // up from the row below
+        next[i] = (unsigned short) (n & ROW_MASK);
+        grew |= (next[i] != r);
+    }
+    return grew;
+}
+
+short int Quoridor_state::flood_fill_path(short int x, short int y, char player, const unsigned short hw[9], const unsigned short vw[9]) {
+    /** Number of steps from (x, y) to the player's goal row or -1 */
+    if (!on_board(x, y)) {
+        cerr << "Error: Invalid coordinates in flood_fill_path()" << endl;   // should not happen
+        return -1;
+    }
+    int endzone = (player == 'W') ? 8 : 0;
+    unsigned short reached[9] = {0}, next[9];
+    reached[x] = (unsigned short) (1 << y);
+    for (short int dist = 0 ; ; dist++) {
+        if (reached[endzone] != 0) return dist;
+        if (!flood_fill_step(reached, hw, vw, next)) return -1;      // no path exists
+        memcpy(reached, next, sizeof(reached));
+    }
+}
+
+void Quoridor_state::calculate_field(char player, const unsigned short hw[9], const unsigned short vw[9], signed char field[9][9]) {
+    /** Flood fill starting from the whole goal row: every new layer of squares is one step further away */
+    memset(field, -1, 81);
+    int endzone = (player == 'W') ? 8 : 0;
+    unsigned short reached[9] = {0}, next[9];
+    reached[endzone] = ROW_MASK;
+    for (int j = 0 ; j < 9 ; j++) {
+        field[endzone][j] = 0;
+    }
+    for (signed char dist = 1 ; flood_fill_step(reached, hw, vw, next) ; dist++) {
+        for (int i = 0 ; i < 9 ; i++) {
+            for (unsigned short layer = next[i] & ~reached[i] ; layer != 0 ; layer &= layer - 1) {
+                field[i][__builtin_ctz(layer)] = dist;
+            }
         }
+        memcpy(reached, next, sizeof(reached));
     }
-    // lambda for goal node check
-    auto is_goal_state = [](char p, short int x) -> bool {
-        if (p == 'W') return x == 8;
-        if (p == 'B') return x == 0;
-        return false;
-    };
-    // perform bfs on the board
-    struct Node {
+}
+
+bool Quoridor_state::wall_keeps_distance(const signed char field[9][9], const unsigned short hw[9], const unsigned short vw[9],
+                                         const Quoridor_move *wall, short int posx, short int posy) {
+    /** Cheap test for a wall (already in hw/vw) not changing the distance of (posx, posy) or, if posx < 0, of any square:
+     * every square that used to step through it towards the goal still has another neighbour one step closer (then by
+     * induction nothing changes). Squares losing their shortest path only affect squares further away from the goal. */
+    static const short int dx[4] = {-1, 1, 0, 0}, dy[4] = {0, 0, -1, 1};
+    bool horizontal = wall->type == 'h';
+    for (int k = 0 ; k < 2 ; k++) {
+        short int ax = wall->x + (horizontal ? 0 : k), ay = wall->y + (horizontal ? k : 0);
+        short int bx = ax + (horizontal ? 1 : 0), by = ay + (horizontal ? 0 : 1);
         short int x, y;
-        int dist;
-        Node(short int x, short int y, int dist) : x(x), y(y), dist(dist) {}
-        bool operator==(const Node& other) const { return x == other.x && y == other.y; }
-    };
-    queue<Node> Q;
-    Q.push(Node(x, y, 0));
-    dists[x][y] = 0;
-    while(!Q.empty()) {
-        // get new node
-        Node n = Q.front();
-        Q.pop();
-        if (stop_at_goal && is_goal_state(player, n.x)) break;
-        // add neighbours to queue if not already explored
-        if (n.x - 1 >= 0 && !horizontal_wall(n.x - 1, n.y) && dists[n.x - 1][n.y] < 0) {             // up
-            dists[n.x - 1][n.y] = n.dist + 1;
-            if (stop_at_goal && is_goal_state(player, n.x - 1)) break;
-            Q.push(Node(n.x - 1, n.y, n.dist + 1));
-        }
-        if (n.x + 1 < 9 && !horizontal_wall(n.x, n.y) && dists[n.x + 1][n.y] < 0) {                  // down
-            dists[n.x + 1][n.y] = n.dist + 1;
-            if (stop_at_goal && is_goal_state(player, n.x + 1)) break;
-            Q.push(Node(n.x + 1, n.y, n.dist + 1));
-        }
-        if (n.y - 1 >= 0 && !vertical_wall(n.x, n.y - 1) && dists[n.x][n.y - 1] < 0) {              // left
-            dists[n.x][n.y - 1] = n.dist + 1;
-            Q.push(Node(n.x, n.y - 1, n.dist + 1));
-        }
-        if (n.y + 1 < 9 && !vertical_wall(n.x, n.y) && dists[n.x][n.y + 1] < 0) {                 // right
-            dists[n.x][n.y + 1] = n.dist + 1;
-            Q.push(Node(n.x, n.y + 1, n.dist + 1));
-        }
-    }
-    return dists;
+        if (field[ax][ay] >= 0 && field[ax][ay] == field[bx][by] + 1) {
+            x = ax; y = ay;
+        } else if (field[bx][by] >= 0 && field[bx][by] == field[ax][ay] + 1) {
+            x = bx; y = by;
+        } else continue;
+        bool still_close = false;
+        for (int d = 0 ; d < 4 && !still_close ; d++) {
+            still_close = !blocked_by(hw, vw, x, y, dx[d], dy[d]) && field[x + dx[d]][y + dy[d]] == field[x][y] - 1;
+        }
+        if (still_close) continue;
+        if (posx < 0 || (posx == x && posy == y) || field[posx][posy] > field[x][y]) return false;
+    }
+    return true;
 }
 
-int Quoridor_state::get_shortest_path(char player, const Quoridor_move *extra_wall_move, short int posx, short int posy) {
-    int endzone = (player == 'W') ? 8 : 0;
-    short int **dists = NULL;
-    if (posx == -1 || posy == -1) {
-        if (player == 'W') {
-            // if not already calculated on a previous call
-            if (wdists == NULL && extra_wall_move == NULL) {
-                // calculate dists to every square using BFS (expensive)
-                wdists = calculate_dists_from(wx, wy, true, 'W');
-            } else if (extra_wall_move != NULL) {
-                posx = wx;
-                posy = wy;
+bool Quoridor_state::find_lengthened(const signed char field[9][9], const unsigned short hw[9], const unsigned short vw[9],
+                                     const Quoridor_move *wall, unsigned short lengthened[9]) {
+    /** Finds the squares whose distance grows if wall (already in hw/vw) is added to the field's board: those that
+     * no longer have a neighbour one step closer to the goal that is reachable without going through another such square.
+     * Every other distance stays the same. Returns false if there are none. */
+    static const short int dx[4] = {-1, 1, 0, 0}, dy[4] = {0, 0, -1, 1};
+    if (wall_keeps_distance(field, hw, vw, wall, -1, -1)) return false;     // (typically) the wall is not in anyone's way
+    short int to_check[4 + 81 * 4][2];       // (!) each square is lengthened at most once
+    int n = 0;
+    // the squares on either side of the wall: the ones that stepped through it may have lost their shortest path
+    bool horizontal = wall->type == 'h';
+    for (int k = 0 ; k < 2 ; k++) {
+        short int ax = wall->x + (horizontal ? 0 : k), ay = wall->y + (horizontal ? k : 0);
+        to_check[n][0] = ax; to_check[n++][1] = ay;
+        to_check[n][0] = ax + (horizontal ? 1 : 0); to_check[n++][1] = ay + (horizontal ? 0 : 1);
+    }
+    memset(lengthened, 0, 9 * sizeof(unsigned short));
+    bool found = false;
+    while (n > 0) {
+        n--;
+        short int x = to_check[n][0], y = to_check[n][1];
+        signed char d = field[x][y];
+        if (d <= 0 || ((lengthened[x] >> y) & 1)) continue;      // goal row, cut off or known already
+        bool still_close = false;
+        for (int k = 0 ; k < 4 && !still_close ; k++) {
+            short int nx = x + dx[k], ny = y + dy[k];
+            still_close = !blocked_by(hw, vw, x, y, dx[k], dy[k]) && field[nx][ny] == d - 1 && !((lengthened[nx] >> ny) & 1);
+        }
+        if (still_close) continue;
+        lengthened[x] |= (unsigned short) (1 << y);
+        found = true;
+        // squares that may have depended on this one
+        for (int k = 0 ; k < 4 ; k++) {
+            short int nx = x + dx[k], ny = y + dy[k];
+            if (!blocked_by(hw, vw, x, y, dx[k], dy[k]) && field[nx][ny] == d + 1) {
+                to_check[n][0] = nx; to_check[n++][1] = ny;
             }
-            dists = wdists;
-        } else if (player == 'B') {
-            // if not already calculated on a previous call
-            if (bdists == NULL && extra_wall_move == NULL) {
-                // calculate dists to every square using BFS (expensive)
-                bdists = calculate_dists_from(bx, by, true, 'B');
-            } else if (extra_wall_move != NULL) {
-                posx = bx;
-                posy = by;
+        }
+    }
+    return found;
+}
+
+void Quoridor_state::repair_field(signed char field[9][9], const unsigned short hw[9], const unsigned short vw[9], const unsigned short lengthened[9]) {
+    /** Recalculates the distances of the lengthened squares (see find_lengthened()) starting from their neighbours that
+     * kept theirs: a BFS whose queue is merged with those starting points in order of distance (i.e. Dijkstra).
+     * Squares are encoded as x * 9 + y. */
+    static const short int dx[4] = {-1, 1, 0, 0}, dy[4] = {0, 0, -1, 1};
+    unsigned short pending[9];
+    memcpy(pending, lengthened, sizeof(pending));
+    short int starts[81], queue[81 * 4];
+    int number_of_starts = 0;
+    for (int i = 0 ; i < 9 ; i++) {
+        for (unsigned short bits = pending[i] ; bits != 0 ; bits &= bits - 1) {
+            int j = __builtin_ctz(bits);
+            field[i][j] = -1;
+            for (int k = 0 ; k < 4 ; k++) {
+                short int nx = i + dx[k], ny = j + dy[k];
+                if (!blocked_by(hw, vw, i, j, dx[k], dy[k]) && !((pending[nx] >> ny) & 1) && field[nx][ny] >= 0 &&
+                        (field[i][j] < 0 || field[nx][ny] + 1 < field[i][j])) {
+                    field[i][j] = (signed char) (field[nx][ny] + 1);
+                }
             }
-            dists = bdists;
+            if (field[i][j] >= 0) starts[number_of_starts++] = (short int) (i * 9 + j);
+        }
+    }
+    const signed char *distance = &field[0][0];
+    sort(starts, starts + number_of_starts, [distance](short int a, short int b) { return distance[a] < distance[b]; });
+    int next_start = 0, head = 0, tail = 0;
+    while (next_start < number_of_starts || head < tail) {
+        // settle the closest pending square
+        short int square;
+        if (head < tail && (next_start == number_of_starts || distance[queue[head]] <= distance[starts[next_start]])) {
+            square = queue[head++];
         } else {
-            cerr << "Invalid player arg" << endl;   // should not happen
-            return -1;
-        }
-    }
-    // if dists is NULL then we need to re-calculate dists separately (disregarding previous value)
-    if (extra_wall_move != NULL) {
-        // should not happen:
-        if (extra_wall_move->type != 'h' && extra_wall_move->type != 'v') {
-            cerr << "Error: extra_wall_move is not a wall move!" << endl;
-            return -1;
-        }
-        if (!legal_wall(extra_wall_move->x, extra_wall_move->y, extra_wall_move->player, extra_wall_move->type == 'h', false)) {   // (!) check_blocking = false to prevent infinite loop
-            cerr << "Error: extra_wall_move is illegal!" << endl;
-            return -1;
-        }
-        // temporarily play the wall move
-        bool horizontal = extra_wall_move->type == 'h';
-        add_wall(extra_wall_move->x, extra_wall_move->y, horizontal);
-        add_wall(extra_wall_move->x + ((int) !horizontal), extra_wall_move->y + ((int) horizontal), horizontal);
-        // calc dists
-        dists = calculate_dists_from(posx, posy, true, player);
-        // remove wall
-        remove_wall(extra_wall_move->x, extra_wall_move->y, horizontal);
-        remove_wall(extra_wall_move->x + ((int) !horizontal), extra_wall_move->y + ((int) horizontal), horizontal);
-    } else if (extra_wall_move == NULL && posx != -1 && posy != -1){
-        // calc dists from custom posx, posy
-        dists = calculate_dists_from(posx, posy, true, player);
-    }
-    // scan the end-zone and keep the minimum
-    #define BIGNUM 9999999
-    int min = BIGNUM;
-    for (int i = 0 ; i < 9 ; i++) {
-        if (dists[endzone][i] >= 0 && dists[endzone][i] < min) {
-            min = dists[endzone][i];
+            square = starts[next_start++];
+        }
+        short int x = square / 9, y = square % 9;
+        if (!((pending[x] >> y) & 1)) continue;     // settled already
+        pending[x] &= (unsigned short) ~(1 << y);
+        for (int k = 0 ; k < 4 ; k++) {
+            short int nx = x + dx[k], ny = y + dy[k];
+            if (!blocked_by(hw, vw, x, y, dx[k], dy[k]) && ((pending[nx] >> ny) & 1) &&
+                    (field[nx][ny] < 0 || field[x][y] + 1 < field[nx][ny])) {
+                field[nx][ny] = (signed char) (field[x][y] + 1);
+                queue[tail++] = (short int) (nx * 9 + ny);
+            }
         }
     }
-    if (min == BIGNUM) min = -1;         // something < 0  ->  no path exists
-    if (extra_wall_move != NULL || !(posx == -1 || posy == -1)) {
-        reset_dists(dists);          // delete from heap
+    // whatever is still pending is cut off from the goal (-1)
+}
+
+const signed char (*Quoridor_state::distance_field(char player))[9] {
+    if (player == 'W') {
+        if (!wfield_valid) {
+            calculate_field('W', hwalls, vwalls, wfield);
+            wfield_valid = true;
+        }
+        return wfield;
+    } else {
+        if (!bfield_valid) {
+            calculate_field('B', hwalls, vwalls, bfield);
+            bfield_valid = true;
+        }
+        return bfield;
     }
-    return min;
 }
 
-void Quoridor_state::reset_dists(short int **&dists) {
-    if (dists == NULL) return;
-    for (int i = 0 ; i < 9 ; i++) {
-        delete[] dists[i];
+int Quoridor_state::get_shortest_path(char player, const Quoridor_move *extra_wall_move, short int posx, short int posy) {
+    if (player != 'W' && player != 'B') {
+        cerr << "Invalid player arg" << endl;   // should not happen
+        return -1;
+    }
+    if (posx == -1 || posy == -1) {
+        posx = (player == 'W') ? wx : bx;
+        posy = (player == 'W') ? wy : by;
+    }
+    const signed char (*field)[9] = distance_field(player);
+    if (extra_wall_move == NULL) {
+        return field[posx][posy];
+    }
+    // should not happen:
+    if (extra_wall_move->type != 'h' && extra_wall_move->type != 'v') {
+        cerr << "Error: extra_wall_move is not a wall move!" << endl;
+        return -1;
+    }
+    if (!legal_wall(extra_wall_move->x, extra_wall_move->y, extra_wall_move->player, extra_wall_move->type == 'h', false)) {   // (!) check_blocking = false to prevent infinite loop
+        cerr << "Error: extra_wall_move is illegal!" << endl;
+        return -1;
+    }
+    // play the wall move on a copy of the bitboards
+    unsigned short hw[9], vw[9];
+    memcpy(hw, hwalls, sizeof(hw));
+    memcpy(vw, vwalls, sizeof(vw));
+    short int x = extra_wall_move->x, y = extra_wall_move->y;
+    if (extra_wall_move->type == 'h') {
+        hw[x] |= (unsigned short) (3 << y);
+    } else {
+        vw[x] |= (unsigned short) (1 << y);
+        vw[x + 1] |= (unsigned short) (1 << y);
+    }
+    // most walls don't make any path longer: then no BFS is needed
+    if (wall_keeps_distance(field, hw, vw, extra_wall_move, posx, posy)) {
+        return field[posx][posy];
     }
-    delete[] dists;
-    dists = NULL;   // (!) has to change that's why we use a reference
+    return flood_fill_path(posx, posy, player, hw, vw);
 }
 
 void Quoridor_state::add_wall(short int x, short int y, bool horizontal) {
-    // Note: this low-level function does NOT reset dists calculated so we need to do that outside if we wish so
-    char put = horizontal ? 'h' : 'v', other = horizontal ? 'v' : 'h';
-    if (walls[x][y] == ' ') walls[x][y] = put;
-    else if (walls[x][y] == other) walls[x][y] = 'b';
-    else { cerr << "Warning: Illegal wall let through!" << endl; }   // should not happen
+    // Note: this low-level function does NOT reset the paths calculated so we need to do that outside if we wish so
+    unsigned short &row = horizontal ? hwalls[x] : vwalls[x];
+    if ((row >> y) & 1) { cerr << "Warning: Illegal wall let through!" << endl; }   // should not happen
+    else row |= (unsigned short) (1 << y);
 }
 
-void Quoridor_state::remove_wall(short x, short y, bool horizontal) {
-    char put = horizontal ? 'h' : 'v', other = horizontal ? 'v' : 'h';
-    if (walls[x][y] == put) walls[x][y] = ' ';
-    else if (walls[x][y] == 'b') walls[x][y] = other;
-    else { cerr << "Warning: Illegal wall let through!" << endl; }   // should not happen
+bool Quoridor_state::blocked_by(const unsigned short hw[9], const unsigned short vw[9], short int x, short int y, short int dx, short int dy) {
+    /** whether a pawn at (x, y) cannot step towards (dx, dy) because of a wall (of the given bitboards) or the end of the board */
+    if (!on_board(x + dx, y + dy)) return true;
+    if (dx == -1) return (hw[x - 1] >> y) & 1;
+    if (dx == 1) return (hw[x] >> y) & 1;
+    if (dy == -1) return (vw[x] >> (y - 1)) & 1;
+    return (vw[x] >> y) & 1;
+}
+
+void Quoridor_state::step_targets(char p, unsigned short targets[9]) const {
+    /** Marks every square that player p can step on (including jumps over the enemy pawn) in a bitboard */
+    static const short int dx[4] = {-1, 1, 0, 0}, dy[4] = {0, 0, -1, 1};
+    short int posx = (p == 'W') ? wx : bx, posy = (p == 'W') ? wy : by;
+    short int enemy_posx = (p == 'W') ? bx : wx, enemy_posy = (p == 'W') ? by : wy;
+    for (int i = 0 ; i < 9 ; i++) {
+        targets[i] = 0;
+    }
+    for (int d = 0 ; d < 4 ; d++) {
+        if (blocked(posx, posy, dx[d], dy[d])) continue;
+        short int x = posx + dx[d], y = posy + dy[d];
+        if (x != enemy_posx || y != enemy_posy) {
+            targets[x] |= (unsigned short) (1 << y);                                   // step
+        } else if (!blocked(x, y, dx[d], dy[d])) {
+            targets[x + dx[d]] |= (unsigned short) (1 << (y + dy[d]));                 // jump over the enemy
+        } else {
+            // the jump is blocked by a wall or the end of the board: go around the enemy (diagonally)
+            for (int side = -1 ; side <= 1 ; side += 2) {
+                short int sx = dy[d] * side, sy = dx[d] * side;
+                if (!blocked(x, y, sx, sy)) {
+                    targets[x + sx] |= (unsigned short) (1 << (y + sy));
+                }
+            }
+        }
+    }
 }
 
 bool Quoridor_state::legal_step(short int x, short int y, char p) const {
     // check if our turn
     if (p != turn) return false;
     // check if out-of-bouds
-    if (x < 0 || x >= 9 || y < 0 || y >= 9) return false;
-    // check if move falls into an occupied square
-    if ((x == bx && y == by) || (x == wx && y == wy)) return false;
-    // determine two player's pos
-    short int posx, posy, enemy_posx, enemy_posy;
-    if (p == 'W') {
-        posx = wx;
-        posy = wy;
-        enemy_posx = bx;
-        enemy_posy = by;
-    } else if (p == 'B') {
-        posx = bx;
-        posy = by;
-        enemy_posx = wx;
-        enemy_posy = wy;
-    } else return false;
-    // check all possible legal moves one-by-one
-    if (y == posy) {
-        if (x >= 0 && !horizontal_wall(posx - 1, posy)) {
-            if (x == posx - 1) return true;                                     // up
-            if (x == posx - 2 && !horizontal_wall(posx - 2, posy) &&
-                enemy_posy == posy && enemy_posx == posx - 1) return true;      // up-up
-        }
-        if (x < 9 && !horizontal_wall(posx, posy)) {
-            if (x == posx + 1) return true;                                     // down
-            if (x == posx + 2 && !horizontal_wall(posx + 1, posy) &&
-                enemy_posy == posy && enemy_posx == posx + 1) return true;      // down-down
-        }
-    }
-    if (x == posx) {
-        if (y >= 0 && !vertical_wall(posx, posy - 1)) {
-            if (y == posy - 1) return true;                                     // left
-            if (y == posy - 2 && !vertical_wall(posx, posy - 2) &&
-                enemy_posx == posx && enemy_posy == posy - 1) return true;      // left-left
-        }
-        if (y < 9 && !vertical_wall(posx, posy)) {
-            if (y == posy + 1) return true;                                     // right
-            if (y == posy + 2 && !vertical_wall(posx, posy + 1) &&
-                enemy_posx == posx && enemy_posy == posy + 1) return true;      // right-right
-        }
-    }
-    // check diagonal moves
-    if (x >= 0 && y >= 0 && x == posx - 1 && y == posy - 1) {                   // up-left
-        if (enemy_posx == posx - 1 && enemy_posy == posy &&
-            (posx - 2 < 0 || horizontal_wall(posx - 2, posy)) &&
-            !vertical_wall(posx - 1, posy - 1) &&
-            !horizontal_wall(posx - 1, posy)) return true;
-        if (enemy_posx == posx && enemy_posy == posy - 1 &&
-            (posy - 2 < 0 || vertical_wall(posx, posy - 2)) &&
-            !horizontal_wall(posx - 1, posy - 1) &&
-            !vertical_wall(posx, posy - 1)) return true;
-    }
-    if (x >= 0 && y < 9 && x == posx - 1 && y == posy + 1) {                    // up-right
-        if (enemy_posx == posx - 1 && enemy_posy == posy &&
-            (posx - 2 < 0 || horizontal_wall(posx - 2, posy)) &&
-            !vertical_wall(posx - 1, posy) &&
-            !horizontal_wall(posx - 1, posy)) return true;
-        if (enemy_posx == posx && enemy_posy == posy + 1 &&
-            (posy + 2 >= 9 || vertical_wall(posx, posy + 1)) &&
-            !horizontal_wall(posx - 1, posy + 1) &&
-            !vertical_wall(posx, posy)) return true;
-    }
-    if (x < 9 && y >= 0 && x == posx + 1 && y == posy - 1) {                   // down-left
-        if (enemy_posx == posx + 1 && enemy_posy == posy &&
-            (posx + 2 >= 9 || horizontal_wall(posx + 1, posy)) &&
-            !vertical_wall(posx + 1, posy - 1) &&
-            !horizontal_wall(posx, posy)) return true;
-        if (enemy_posx == posx && enemy_posy == posy - 1 &&
-            (posy - 2 < 0 || vertical_wall(posx, posy - 2)) &&
-            !horizontal_wall(posx, posy - 1) &&
-            !vertical_wall(posx, posy - 1)) return true;
-    }
-    if (x < 9 && y < 9 && x == posx + 1 && y == posy + 1) {                   // down-right
-        if (enemy_posx == posx + 1 && enemy_posy == posy &&
-            (posx + 2 >= 9 || horizontal_wall(posx + 1, posy)) &&
-            !vertical_wall(posx + 1, posy) &&
-            !horizontal_wall(posx, posy)) return true;
-        if (enemy_posx == posx && enemy_posy == posy + 1 &&
-            (posy + 2 >= 9 || vertical_wall(posx, posy + 1)) &&
-            !horizontal_wall(posx, posy + 1) &&
-            !vertical_wall(posx, posy)) return true;
-    }
-    return false;
+    if (!on_board(x, y)) return false;
+    if (p != 'W' && p != 'B') return false;
+    unsigned short targets[9];
+    step_targets(p, targets);
+    return (targets[x] >> y) & 1;
 }
 
 bool Quoridor_state::legal_wall(short int x, short int y, char p, bool horizontal, bool check_blocking) {
@@ -295,9 +355,8 @@ bool Quoridor_state::legal_wall(short int x, short int y, char p, bool horizonta
     if (p == 'W' && wwallsno <= 0) return false;
     if (p == 'B' && bwallsno <= 0) return false;
     // check if blocked by the same wall or by an opposite wall at the same exact spot
-    char type = (horizontal) ? 'h' : 'v';
-    char opposite_type = (horizontal) ? 'v' : 'h';
-    if (walls[x][y] == type || walls[x][y] == 'b' || (walls[x][y] == opposite_type && wall_connections[x][y])) return false;
+    unsigned short same = horizontal ? hwalls[x] : vwalls[x], opposite = horizontal ? vwalls[x] : hwalls[x];
+    if (((same >> y) & 1) || (((opposite >> y) & 1) && connected_wall(x, y))) return false;
     // check if the second part of the wall is blocked
     if (horizontal && horizontal_wall(x, y + 1)) return false;
     if (!horizontal && vertical_wall(x + 1, y)) return false;
@@ -306,14 +365,13 @@ bool Quoridor_state::legal_wall(short int x, short int y, char p, bool horizonta
         // TODO: if there are no walls/edges in both sides then there is no way this wall closed any paths.. -> don't bfs
         // But that is very hard to check so instead just check for completely isolated ones:
         bool isolated = true;
-        for (int i = x - 1 ; i <= x + 1 + ((int) !horizontal) ; i++) {
-            if (i < 0 || i >= 9) continue;       // ignore out-of-bounds areas
-            for (int j = y - 1 ; j <= y + 1 + ((int) horizontal) ; j++) {
-                if (j < 0 || j >= 9) continue;   // ignore out-of-bounds areas
-                if (walls[i][j] != ' ') {
-                    isolated = false;
-                    break;
-                }
+        int first_col = MAX(y - 1, 0), last_col = y + 1 + ((int) horizontal);
+        if (last_col > 8) last_col = 8;                  // ignore out-of-bounds areas
+        unsigned short window = (unsigned short) (((1 << (last_col - first_col + 1)) - 1) << first_col);
+        for (int i = MAX(x - 1, 0) ; i <= x + 1 + ((int) !horizontal) && i < 9 ; i++) {
+            if ((hwalls[i] | vwalls[i]) & window) {
+                isolated = false;
+                break;
             }
         }
         if (!isolated) {           // skip this check for isolated walls
@@ -354,38 +412,45 @@ bool Quoridor_state::play_move(const Quoridor_move *move) {
         } else {
             add_wall(move->x + 1, move->y, false);
         }
-        wall_connections[move->x][move->y] = true;
+        wall_connections[move->x] |= (unsigned char) (1 << move->y);
+        zobrist ^= zobrist_keys()[ZOBRIST_WALL(move->x, move->y, move->type)];
         // reduce walls
         switch (move->player) {
             case 'W':
+                zobrist ^= zobrist_keys()[ZOBRIST_WHITE_WALLS(wwallsno)] ^ zobrist_keys()[ZOBRIST_WHITE_WALLS(wwallsno - 1)];
                 wwallsno--;
                 break;
             case 'B':
+                zobrist ^= zobrist_keys()[ZOBRIST_BLACK_WALLS(bwallsno)] ^ zobrist_keys()[ZOBRIST_BLACK_WALLS(bwallsno - 1)];
                 bwallsno--;
                 break;
         }
-        // reset all dists
-        reset_dists(wdists);
-        reset_dists(bdists);
+        // repair the distance fields
+        unsigned short lengthened[9];
+        if (wfield_valid && find_lengthened(wfield, hwalls, vwalls, move, lengthened)) {
+            repair_field(wfield, hwalls, vwalls, lengthened);
+        }
+        if (bfield_valid && find_lengthened(bfield, hwalls, vwalls, move, lengthened)) {
+            repair_field(bfield, hwalls, vwalls, lengthened);
+        }
     } else {                                        // pawn move
         // play legal move
         switch (move->player) {
             case 'W':
+                zobrist ^= zobrist_keys()[ZOBRIST_WHITE_PAWN(wx, wy)] ^ zobrist_keys()[ZOBRIST_WHITE_PAWN(move->x, move->y)];
                 wx = move->x;
                 wy = move->y;
-                // reset his dists
-                reset_dists(wdists);
                 break;
             case 'B':
+                zobrist ^= zobrist_keys()[ZOBRIST_BLACK_PAWN(bx, by)] ^ zobrist_keys()[ZOBRIST_BLACK_PAWN(move->x, move->y)];
                 bx = move->x;
                 by = move->y;
-                // reset his dists
-                reset_dists(bdists);
                 break;
         }
     }
     // change turn
     change_turn();
+    zobrist ^= zobrist_keys()[ZOBRIST_BLACK_TURN];
     // add to move counter
     move_counter++;
     return true;
@@ -419,9 +484,9 @@ void Quoridor_state::print() const {
         cout << endl << "    +";
         for (int col = 0 ; col < 9 ; col++) {
             if (horizontal_wall(row, col)) {
-                printf("═════%s", wall_connections[row][col] ? ((row < 8 && vertical_wall(row, col) && wall_connections[row][col] && vertical_wall(row + 1, col)) ? VWALL : "═") : "+");
+                printf("═════%s", connected_wall(row, col) ? ((row < 8 && vertical_wall(row, col) && connected_wall(row, col) && vertical_wall(row + 1, col)) ? VWALL : "═") : "+");
             } else if (row < 8) {
-                printf("-----%s", (vertical_wall(row, col) && wall_connections[row][col] && vertical_wall(row + 1, col)) ? VWALL : "+");
+                printf("-----%s", (vertical_wall(row, col) && connected_wall(row, col) && vertical_wall(row + 1, col)) ? VWALL : "+");
             } else {
                 printf(" ━━━ +");
             }
@@ -435,41 +500,40 @@ void Quoridor_state::print() const {
     cout << endl << endl;
 }
 
-forward_list<MCTS_move *> Quoridor_state::get_legal_step_moves(char p) const {
-    forward_list<MCTS_move *> Q;
+/** Every step a pawn could make (including jumps): moves are listed in this order by get_legal_step_moves2() and
+ * in reverse order by get_legal_step_moves() and legal_step_moves() */
+static const short int STEP_OFFSETS[12][2] = {{-1, 0}, {-2, 0}, {1, 0}, {2, 0}, {0, -1}, {0, -2}, {0, 1}, {0, 2},
+                                              {-1, -1}, {-1, 1}, {1, -1}, {1, 1}};
+
+void Quoridor_state::legal_step_moves(char p, vector<Quoridor_move> &moves) const {
+    if (p != turn) return;
     short int posx = (turn == 'W') ? wx : bx;
     short int posy = (turn == 'W') ? wy : by;
-    if (legal_step(posx - 1, posy, p)) Q.push_front(new Quoridor_move(posx - 1, posy, p, ' '));
-    if (legal_step(posx - 2, posy, p)) Q.push_front(new Quoridor_move(posx - 2, posy, p, ' '));
-    if (legal_step(posx + 1, posy, p)) Q.push_front(new Quoridor_move(posx + 1, posy, p, ' '));
-    if (legal_step(posx + 2, posy, p)) Q.push_front(new Quoridor_move(posx + 2, posy, p, ' '));
-    if (legal_step(posx, posy - 1, p)) Q.push_front(new Quoridor_move(posx, posy - 1, p, ' '));
-    if (legal_step(posx, posy - 2, p)) Q.push_front(new Quoridor_move(posx, posy - 2, p, ' '));
-    if (legal_step(posx, posy + 1, p)) Q.push_front(new Quoridor_move(posx, posy + 1, p, ' '));
-    if (legal_step(posx, posy + 2, p)) Q.push_front(new Quoridor_move(posx, posy + 2, p, ' '));
-    if (legal_step(posx - 1, posy - 1, p)) Q.push_front(new Quoridor_move(posx - 1, posy - 1, p, ' '));
-    if (legal_step(posx - 1, posy + 1, p)) Q.push_front(new Quoridor_move(posx - 1, posy + 1, p, ' '));
-    if (legal_step(posx + 1, posy - 1, p)) Q.push_front(new Quoridor_move(posx + 1, posy - 1, p, ' '));
-    if (legal_step(posx + 1, posy + 1, p)) Q.push_front(new Quoridor_move(posx + 1, posy + 1, p, ' '));
+    unsigned short targets[9];
+    step_targets(p, targets);       // (!) once for all candidate squares
+    for (int i = 11 ; i >= 0 ; i--) {
+        short int x = posx + STEP_OFFSETS[i][0], y = posy + STEP_OFFSETS[i][1];
+        if (on_board(x, y) && ((targets[x] >> y) & 1)) moves.push_back(Quoridor_move(x, y, p, ' '));
+    }
+}
+
+forward_list<MCTS_move *> Quoridor_state::get_legal_step_moves(char p) const {
+    vector<Quoridor_move> steps;
+    legal_step_moves(p, steps);
+    forward_list<MCTS_move *> Q;
+    for (auto it = steps.rbegin() ; it != steps.rend() ; ++it) {
+        Q.push_front(new Quoridor_move(*it));
+    }
     return Q;
 }
 
 vector<MCTS_move *> Quoridor_state::get_legal_step_moves2(char p) const {
+    vector<Quoridor_move> steps;
+    legal_step_moves(p, steps);
     vector<MCTS_move *> Q;
-    short int posx = (turn == 'W') ? wx : bx;
-    short int posy = (turn == 'W') ? wy : by;
-    if (legal_step(posx - 1, posy, p)) Q.push_back(new Quoridor_move(posx - 1, posy, p, ' '));
-    if (legal_step(posx - 2, posy, p)) Q.push_back(new Quoridor_move(posx - 2, posy, p, ' '));
-    if (legal_step(posx + 1, posy, p)) Q.push_back(new Quoridor_move(posx + 1, posy, p, ' '));
-    if (legal_step(posx + 2, posy, p)) Q.push_back(new Quoridor_move(posx + 2, posy, p, ' '));
-    if (legal_step(posx, posy - 1, p)) Q.push_back(new Quoridor_move(posx, posy - 1, p, ' '));
-    if (legal_step(posx, posy - 2, p)) Q.push_back(new Quoridor_move(posx, posy - 2, p, ' '));
-    if (legal_step(posx, posy + 1, p)) Q.push_back(new Quoridor_move(posx, posy + 1, p, ' '));
-    if (legal_step(posx, posy + 2, p)) Q.push_back(new Quoridor_move(posx, posy + 2, p, ' '));
-    if (legal_step(posx - 1, posy - 1, p)) Q.push_back(new Quoridor_move(posx - 1, posy - 1, p, ' '));
-    if (legal_step(posx - 1, posy + 1, p)) Q.push_back(new Quoridor_move(posx - 1, posy + 1, p, ' '));
-    if (legal_step(posx + 1, posy - 1, p)) Q.push_back(new Quoridor_move(posx + 1, posy - 1, p, ' '));
-    if (legal_step(posx + 1, posy + 1, p)) Q.push_back(new Quoridor_move(posx + 1, posy + 1, p, ' '));
+    for (auto it = steps.rbegin() ; it != steps.rend() ; ++it) {
+        Q.push_back(new Quoridor_move(*it));
+    }
     return Q;
 }
 
@@ -496,6 +560,23 @@ Quoridor_move *Quoridor_state::get_best_step_move(char player) {
     return argmin;
 }
 
+void Quoridor_state::action_priorities(const vector<MCTS_move *> &actions, vector<double> &priorities) const {
+    /** Steps: how much closer to our goal they take us. Walls: how much more they encumber the enemy than us (as in good_moves()) */
+    Quoridor_state s(*this);         // (!) get_shortest_path() caches the distance fields
+    char p = turn, enemy = (turn == 'W') ? 'B' : 'W';
+    int our_path = s.get_shortest_path(p), enemy_path = s.get_shortest_path(enemy);
+    for (size_t i = 0 ; i < actions.size() ; i++) {
+        const Quoridor_move *m = (const Quoridor_move *) actions[i];
+        if (m->type == 'h' || m->type == 'v') {
+            int enemy_path_with_wall = s.get_shortest_path(enemy, m);
+            int our_path_with_wall = s.get_shortest_path(p, m);
+            priorities[i] = (enemy_path_with_wall - enemy_path) - (our_path_with_wall - our_path);
+        } else {
+            priorities[i] = our_path - s.get_shortest_path(p, NULL, m->x, m->y);
+        }
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////
 
 bool Quoridor_state::is_terminal() const {
@@ -503,6 +584,11 @@ bool Quoridor_state::is_terminal() const {
     return winner == 'W' || winner == 'B';
 }
 
+unsigned long long Quoridor_state::hash() const {
+    // (!) the same position at a different ply is a different node so that the tree stays acyclic (pawns can move back and forth)
+    return zobrist ^ (move_counter * 0x9E3779B97F4A7C15ULL);
+}
+
 MCTS_state *Quoridor_state::next_state(const MCTS_move *move) const {
     Quoridor_state *new_state = new Quoridor_state(*this);
     new_state->play_move((const Quoridor_move *) move);
@@ -515,16 +601,12 @@ MCTS_state *Quoridor_state::next_state(const MCTS_move *move) const {
  *  in subtrees caused by bad enemy (and also ours) moves, where we would probably be better anyway.
  *  Although, that is addressed by UCT as well.
  */
-queue<MCTS_move *> *Quoridor_state::generate_good_moves() {
+void Quoridor_state::good_moves(vector<Quoridor_move> &Q) {
     #define MIN_ENC_FOR_STOPPING_ENEMY_WALLS 3
 
     char p = turn, enemy = (turn == 'W') ? 'B' : 'W';
-    queue<MCTS_move *> *Q = new queue<MCTS_move *>();
     // First consider all legal step moves
-    forward_list<MCTS_move *> list = get_legal_step_moves(p);
-    for (auto &move : list) {
-        Q->push(move);
-    }
+    legal_step_moves(p, Q);
     // Then consider good wall moves
     if (remaining_walls(p) > 0) {
         int our_path = get_shortest_path(p);
@@ -535,51 +617,43 @@ queue<MCTS_move *> *Quoridor_state::generate_good_moves() {
                 for (short int k = 0; k < 2; k++) {                                  // orientation
                     if (legal_wall(i, j, p, k == 0, false)) {   // cheap version (don't double count)
                         // First (!), check if this walls encumbers our enemy more than us
-                        Quoridor_move *wallmove = new Quoridor_move(i, j, p, (k == 0) ? 'h' : 'v');
-                        int enemy_path_with_wall = get_shortest_path(enemy, wallmove);
+                        Quoridor_move wallmove(i, j, p, (k == 0) ? 'h' : 'v');
+                        int enemy_path_with_wall = get_shortest_path(enemy, &wallmove);
                         int enemy_enc = enemy_path_with_wall - enemy_path;
-                        int our_path_with_wall = get_shortest_path(p, wallmove);
+                        int our_path_with_wall = get_shortest_path(p, &wallmove);
                         int our_enc = our_path_with_wall - our_path;
                         // must annoy the enemy more than us (and be legal when it comes to blocking)
                         if (!already_used[i][j][k] && enemy_enc > our_enc &&
                                 enemy_path_with_wall >= 0 && our_path_with_wall >= 0) {
                             already_used[i][j][k] = true;
-                            Q->push(wallmove);
-                        } else {
-                            delete wallmove;
+                            Q.push_back(wallmove);
                         }
                         // Then, if this encumbers us significantly more than the enemy check for counter-walls
                         if (remaining_walls(enemy) > 0 && our_enc - enemy_enc >= MIN_ENC_FOR_STOPPING_ENEMY_WALLS) {
                             // same pos, opposite orientation (!)
-                            Quoridor_move *countermove = new Quoridor_move(i, j,  p, (k == 0) ? 'v' : 'h');
-                            if (!already_used[i][j][1 - k] && legal_move(countermove)) {         // also checks blocking
+                            Quoridor_move countermove(i, j,  p, (k == 0) ? 'v' : 'h');
+                            if (!already_used[i][j][1 - k] && legal_move(&countermove)) {         // also checks blocking
                                 already_used[i][j][1 - k] = true;
-                                Q->push(countermove);
-                            } else {
-                                delete countermove;
+                                Q.push_back(countermove);
                             }
                             // same orientation, moved by 1 square on each side
                             if (k == 0) {
                                 if (j - 1 >= 0 && !already_used[i][j-1][k] && legal_wall(i, j - 1, p, true)) {
-                                    countermove = new Quoridor_move(i, j - 1, p, 'h');
                                     already_used[i][j-1][k] = true;
-                                    Q->push(countermove);
+                                    Q.push_back(Quoridor_move(i, j - 1, p, 'h'));
                                 }
                                 if (j + 1 < 8 && !already_used[i][j+1][k] && legal_wall(i, j + 1, p, true)) {
-                                    countermove = new Quoridor_move(i, j + 1, p, 'h');
                                     already_used[i][j+1][k] = true;
-                                    Q->push(countermove);
+                                    Q.push_back(Quoridor_move(i, j + 1, p, 'h'));
                                 }
                             } else if (k == 1) {
                                 if (i - 1 >= 0 && !already_used[i-1][j][k] && legal_wall(i - 1, j, p, false)) {
-                                    countermove = new Quoridor_move(i - 1, j, p, 'v');
                                     already_used[i-1][j][k] = true;
-                                    Q->push(countermove);
+                                    Q.push_back(Quoridor_move(i - 1, j, p, 'v'));
                                 }
                                 if (i + 1 < 8 && !already_used[i+1][j][k] && legal_wall(i + 1, j, p, false)) {
-                                    countermove = new Quoridor_move(i + 1, j, p, 'v');
                                     already_used[i+1][j][k] = true;
-                                    Q->push(countermove);
+                                    Q.push_back(Quoridor_move(i + 1, j, p, 'v'));
                                 }
                             }
                         }
@@ -588,42 +662,102 @@ queue<MCTS_move *> *Quoridor_state::generate_good_moves() {
             }
         }
     }
-    return Q;
 }
 
-queue<MCTS_move *> *Quoridor_state::generate_all_moves() {
+void Quoridor_state::all_moves(vector<Quoridor_move> &Q) {
     char p = turn, enemy = (turn == 'W') ? 'B' : 'W';
-    queue<MCTS_move *> *Q = new queue<MCTS_move *>();
     // First consider all legal step moves
-    forward_list<MCTS_move *> list = get_legal_step_moves(p);
-    for (auto &move : list) {
-        Q->push(move);
-    }
+    legal_step_moves(p, Q);
     // Second consider all wall moves
     if (remaining_walls(p) > 0) {
         for (short int i = 0; i < 8; i++) {
             for (short int j = 0; j < 8; j++) {
                 for (short int k = 0; k < 2; k++) {
                     if (legal_wall(i, j, p, k == 0, true)) {
-                        Quoridor_move *wallmove = new Quoridor_move(i, j, p, (k == 0) ? 'h' : 'v');
-                        Q->push(wallmove);
+                        Q.push_back(Quoridor_move(i, j, p, (k == 0) ? 'h' : 'v'));
                     }
                 }
             }
         }
     }
+}
+
+static queue<MCTS_move *> *to_queue(const vector<Quoridor_move> &moves) {
+    queue<MCTS_move *> *Q = new queue<MCTS_move *>();
+    for (const Quoridor_move &m : moves) {
+        Q->push(new Quoridor_move(m));
+    }
     return Q;
 }
 
+queue<MCTS_move *> *Quoridor_state::generate_good_moves() {
+    vector<Quoridor_move> moves;
+    moves.reserve(12 + 128);
+    good_moves(moves);
+    return to_queue(moves);
+}
+
+queue<MCTS_move *> *Quoridor_state::generate_all_moves() {
+    vector<Quoridor_move> moves;
+    moves.reserve(12 + 128);
+    all_moves(moves);
+    return to_queue(moves);
+}
+
+void Quoridor_state::legal_moves(vector<Quoridor_move> &moves) {
+    /** Same moves as actions_to_try() but by value (for MCTS_static_tree) */
+    if (test_all_moves) {
+        all_moves(moves);
+    } else {
+        good_moves(moves);
+    }
+}
+
 queue<MCTS_move *> *Quoridor_state::actions_to_try() const {
     /** Note: actions_to_try() should probably be const in superclass but it would be very inefficient
      * to be so here because we would need to recalculate paths every time!
      * This is a hack to avoid const error in this specific case. */
-#ifdef TEST_ALL_MOVES
-    return const_cast<Quoridor_state *>(this)->generate_all_moves();
-#else
+    if (test_all_moves) {
+        return const_cast<Quoridor_state *>(this)->generate_all_moves();
+    }
     return const_cast<Quoridor_state *>(this)->generate_good_moves();
-#endif
+}
+
+MCTS_move_generator *Quoridor_state::actions_generator() const {
+    if (test_all_moves) {
+        return new Quoridor_move_generator(*this);
+    }
+    return MCTS_state::actions_generator();       // generate_good_moves() needs to see all walls at once
+}
+
+Quoridor_move_generator::Quoridor_move_generator(const Quoridor_state &state) : s(state), next_wall(0) {
+    steps = s.get_legal_step_moves(s.turn);       // cheap (no bfs)
+    number_of_steps = (unsigned int) distance(steps.begin(), steps.end());
+    if (s.remaining_walls(s.turn) <= 0) next_wall = 128;
+}
+
+Quoridor_move_generator::~Quoridor_move_generator() {
+    for (auto *move : steps) {
+        delete move;
+    }
+}
+
+MCTS_move *Quoridor_move_generator::next() {
+    // same order as generate_all_moves()
+    if (!steps.empty()) {
+        MCTS_move *move = steps.front();
+        steps.pop_front();
+        number_of_steps--;
+        return move;
+    }
+    while (next_wall < 128) {
+        short int i = next_wall / 16, j = (next_wall / 2) % 8, k = next_wall % 2;
+        next_wall++;
+        if (s.legal_wall(i, j, s.turn, k == 0, true)) {
+            return new Quoridor_move(i, j, s.turn, (k == 0) ? 'h' : 'v');
+        }
+    }
+    return NULL;
 }
 
 double evaluate_position(Quoridor_state &s, bool cheap) {
@@ -677,7 +811,7 @@ bool force_playwall(Quoridor_state &s) {
     return false;
 }
 
-Quoridor_move *pick_semirandom_move(Quoridor_state &s, uniform_real_distribution<double> &dist, default_random_engine &gen) {
+Quoridor_move *pick_semirandom_move(Quoridor_state &s, uniform_real_distribution<double> &dist, MCTS_rng &gen, vector<Quoridor_move> &pool) {
     #define WALL_VS_MOVE_CHANCE 0.4
     #define BEST_VS_RANDOM_MOVE 0.8
     #define BEST_WALLMOVE 0.1                   // this is much more expensive
@@ -703,16 +837,15 @@ Quoridor_move *pick_semirandom_move(Quoridor_state &s, uniform_real_distribution
          *   and if so play it, else continue searching. If no good move was found return random one or step move.
          */
         // TODO: A wall could be good in other ways as well e.g. blocks an enemy good wall. How do we consider those cheaply?
-        // play wall
-        vector<Quoridor_move *> pool;
-        pool.reserve(128);
+        // play wall (the pool is the caller's scratch buffer, by value: only the chosen wall is allocated)
+        pool.clear();
         for (short int i = 0; i < 8; i++) {
             for (short int j = 0; j < 8; j++) {
                 if (s.legal_wall(i, j, p, true, false)) {    // cheap checks (no check for blocking)
-                    pool.push_back(new Quoridor_move(i, j, p, 'h'));
+                    pool.push_back(Quoridor_move(i, j, p, 'h'));
                 }
                 if (s.legal_wall(i, j, p, false, false)) {   // cheap checks (no check for blocking)
-                    pool.push_back(new Quoridor_move(i, j, p, 'v'));
+                    pool.push_back(Quoridor_move(i, j, p, 'v'));
                 }
             }
         }
@@ -721,69 +854,48 @@ Quoridor_move *pick_semirandom_move(Quoridor_state &s, uniform_real_distribution
         if (dist(gen) < BEST_WALLMOVE) {
             /** Note: random shuffling should make the choice of maximum random in case of multiple equivalents **/
             // check all wallmove's enc and pick the best (as in maximum difference in encumbrances)
-            Quoridor_move *bestwallmove = NULL;
+            const Quoridor_move *bestwallmove = NULL;
             int max_enc_diff = 0.0;
-            for (Quoridor_move *move : pool) {
+            for (const Quoridor_move &move : pool) {
                 /** Note: we also check if the wall is legal for blocking manually */
-                int enemy_path = s.get_shortest_path(enemy, move);
+                int enemy_path = s.get_shortest_path(enemy, &move);
                 int enemy_enc = enemy_path - s.get_shortest_path(enemy);
                 if (enemy_path >= 0 && enemy_enc > 0) {
-                    int our_path = s.get_shortest_path(p, move);
+                    int our_path = s.get_shortest_path(p, &move);
                     int our_enc = our_path - s.get_shortest_path(p);
                     if (our_path >= 0 && enemy_enc > our_enc) {         // must annoy the enemy more than us
                         if (enemy_enc - our_enc > max_enc_diff) {
-                            delete bestwallmove;
-                            bestwallmove = move;
+                            bestwallmove = &move;
                             max_enc_diff = enemy_enc - our_enc;
-                        } else {
-                            delete move;
                         }
-                    } else delete move;
-                } else delete move;
+                    }
+                }
             }
             // if found a good move play the first one we found goon enough randomly
-            if (bestwallmove != NULL) return bestwallmove;
+            if (bestwallmove != NULL) return new Quoridor_move(*bestwallmove);
             // else resort to a step move by not returning here
         } else {
             if (dist(gen) < GUIDED_RANDOM_WALL) {
-                // random but at least helpful in an obvious way
-                Quoridor_move *wallmove = NULL;
-                // examine moves in (random) order
-                bool accepted = false;
-                for (Quoridor_move *move : pool) {
-                    if (!accepted) {
-                        /** Note: we also check if the wall is legal for blocking manually */
-                        int enemy_path = s.get_shortest_path(enemy, move);
-                        int enemy_enc = enemy_path - s.get_shortest_path(enemy);
-                        if (enemy_path >= 0 && enemy_enc > 0) {
-                            int our_path = s.get_shortest_path(p, move);
-                            int our_enc = our_path - s.get_shortest_path(p);
-                            if (our_path >= 0 && enemy_enc > our_enc) {         // must annoy the enemy more than us
-                                wallmove = move;
-                                accepted = true;
-                                continue;             // avoids deleting this move
-                            }
+                // random but at least helpful in an obvious way: examine moves in (random) order
+                for (const Quoridor_move &move : pool) {
+                    /** Note: we also check if the wall is legal for blocking manually */
+                    int enemy_path = s.get_shortest_path(enemy, &move);
+                    int enemy_enc = enemy_path - s.get_shortest_path(enemy);
+                    if (enemy_path >= 0 && enemy_enc > 0) {
+                        int our_path = s.get_shortest_path(p, &move);
+                        int our_enc = our_path - s.get_shortest_path(p);
+                        if (our_path >= 0 && enemy_enc > our_enc) {         // must annoy the enemy more than us
+                            // found a good move: play the first one we found good enough randomly
+                            return new Quoridor_move(move);
                         }
                     }
-                    delete move;                     // delete all not selected moves
                 }
-                // if found a good move play the first one we found goon enough randomly
-                if (wallmove != NULL) return wallmove;
                 // else resort to a step move by not returning here
             } else {
-                // completely random wall move
-                Quoridor_move *wallmove = NULL;
-                bool accepted = false;
-                for (Quoridor_move *move : pool) {
-                    if (!accepted && s.legal_move(move)) {       // return the first legal move
-                        wallmove = move;
-                        accepted = true;
-                        continue;
-                    }
-                    delete move;
+                // completely random wall move: return the first legal one
+                for (const Quoridor_move &move : pool) {
+                    if (s.legal_move(&move)) return new Quoridor_move(move);
                 }
-                // if a wallmove exists
-                if (wallmove != NULL) return wallmove;
                 // else resort to a step move by not returning here
             }
         }
@@ -793,7 +905,7 @@ Quoridor_move *pick_semirandom_move(Quoridor_state &s, uniform_real_distribution
         return s.get_best_step_move(s.whose_turn());
     } else {
         vector<MCTS_move *> v = s.get_legal_step_moves2(s.whose_turn());
-        int r = rand() % v.size();
+        int r = (int) (gen() % v.size());
         for (int i = 0 ; i < v.size() ; i++) {
             if (i != r) delete v[i];
         }
@@ -802,17 +914,15 @@ Quoridor_move *pick_semirandom_move(Quoridor_state &s, uniform_real_distribution
     cerr << "Warning: could not find a legal move?" << endl << endl;
 }
 
-/**
- * Player1's (== white) win chance is returned. If genmove is for black
- * then this is dealt with in select_best_child of mcts!
- */
-double Quoridor_state::rollout() const {
+/** One rollout from start (whose distance fields are best already calculated) with pool as scratch buffer for walls.
+ * The ids of the moves played are appended to played unless it is NULL. */
+static double simulate(const Quoridor_state &start, MCTS_rng &rng, vector<Quoridor_move> &pool, vector<int> *played) {
     #define MAXSTEPS 50
     #define EVALUATION_THRESHOLD 0.8     // when eval is this skewed then don't simulate any more, return eval
     // #define DDEBUG
 
     uniform_real_distribution<double> dist(0.0, 1.0);
-    Quoridor_state s(*this);     // copy current state (bypasses const restriction and allows to change state)
+    Quoridor_state s(start);     // copy the starting state (bypasses const restriction and allows to change state)
     bool noerror;
     #ifdef DDEBUG
     queue<Quoridor_move *> hist;
@@ -828,7 +938,7 @@ double Quoridor_state::rollout() const {
             break;
         }
         // otherwise keep simulating until we do or reached a certain depth
-        Quoridor_move *m = pick_semirandom_move(s, dist, generator);
+        Quoridor_move *m = pick_semirandom_move(s, dist, rng, pool);
         if (!s.legal_move(m)) {
             cout << "Picked illegal move: " << ((m != NULL) ? m->sprint() : "NULL" ) << " intentionally! Move history:" << endl;
             #ifdef DDEBUG
@@ -847,9 +957,63 @@ double Quoridor_state::rollout() const {
             cerr << "Error: in rollouts" << endl;
             break;
         }
+        if (played != NULL) played->push_back(m->id());
         #ifndef DDEBUG
         delete m;
         #endif
     }
     return evaluate_position(s, false);
 }
+
+/**
+ * Player1's (== white) win chance is returned. If genmove is for black
+ * then this is dealt with in select_best_child of mcts!
+ */
+double Quoridor_state::rollout(MCTS_rng &rng) const {
+    double result;
+    rollout_batch(1, &rng, &result, NULL);
+    return result;
+}
+
+double Quoridor_state::rollout_with_moves(MCTS_rng &rng, vector<int> &played) const {
+    double result;
+    rollout_batch(1, &rng, &result, &played);
+    return result;
+}
+
+void Quoridor_state::rollout_batch(unsigned int n, MCTS_rng *rngs, double *results, vector<int> *played) const {
+    /** Shared setup: both distance fields of the starting position are calculated once here and inherited by
+     * every simulation's copy, and all simulations use the same wall pool as scratch buffer. */
+    Quoridor_state start(*this);
+    start.get_shortest_path('W');
+    start.get_shortest_path('B');
+    vector<Quoridor_move> pool;
+    pool.reserve(128);
+    for (unsigned int i = 0 ; i < n ; i++) {
+        results[i] = simulate(start, rngs[i], pool, (played != NULL) ? &played[i] : NULL);
+    }
+}
+
+void Quoridor_linear_evaluator::evaluate(const MCTS_state * const *states, unsigned int n, double *values) const {
+    // the features of LINEAR_LANES states side by side (the last block is padded with zeros)
+    struct block { double paths[LINEAR_LANES], walls[LINEAR_LANES], turns[LINEAR_LANES]; };
+    vector<block> features((n + LINEAR_LANES - 1) / LINEAR_LANES, block());
+    for (unsigned int i = 0 ; i < n ; i++) {
+        Quoridor_state s(*(const Quoridor_state *) states[i]);     // (!) a copy since get_shortest_path() caches its fields
+        block &b = features[i / LINEAR_LANES];
+        b.paths[i % LINEAR_LANES] = s.get_shortest_path('B') - s.get_shortest_path('W');
+        b.walls[i % LINEAR_LANES] = s.remaining_walls('W') - s.remaining_walls('B');
+        b.turns[i % LINEAR_LANES] = (s.whose_turn() == 'W') ? 1.0 : -1.0;
+    }
+    for (size_t k = 0 ; k < features.size() ; k++) {
+        const block &b = features[k];
+        double v[LINEAR_LANES];
+        for (unsigned int j = 0 ; j < LINEAR_LANES ; j++) {     // (a fixed number of lanes so that -O2 vectorizes this)
+            v[j] = 0.5 + path_weight * b.paths[j] + wall_weight * b.walls[j] + turn_weight * b.turns[j];
+            v[j] = min(max(v[j], LINEAR_MIN_VALUE), 1.0 - LINEAR_MIN_VALUE);
+        }
+        for (unsigned int j = 0 ; j < LINEAR_LANES && k * LINEAR_LANES + j < n ; j++) {
+            values[k * LINEAR_LANES + j] = v[j];
+        }
+    }
+}
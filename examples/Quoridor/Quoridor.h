@@ -12,7 +12,7 @@
  */
 
 
-struct Quoridor_move : public MCTS_move {
+struct Quoridor_move final : public MCTS_move {     // (final: calls on known moves need no virtual dispatch)
     short int x, y;
     char player;
     char type;         // 'h'/'v' -> horizontal/vertical wall, ' ' or other for move
@@ -26,44 +26,67 @@ struct Quoridor_move : public MCTS_move {
         string playerstr = (player == 'W') ? "White" : "Black";
         return playerstr + " " + movetype + " " + string(1, (char) ('A' + y)) + to_string(x + 1);
     }
+    unsigned long memory_usage() const override { return sizeof(Quoridor_move); }
+    int id() const override {      // steps by target square, then walls by position and orientation, black's after white's
+        int i = (type == 'h' || type == 'v') ? 81 + (x * 8 + y) * 2 + (type == 'v') : x * 9 + y;
+        return (player == 'W') ? i : i + 81 + 128;
+    }
 };
 
 
-class Quoridor_state : public MCTS_state {
+class Quoridor_state final : public MCTS_state {
     /** white's and black's coordinates on the board */
     short int wx, wy, bx, by;
     /** white's and black's remaining number of walls */
     short int wwallsno, bwallsno;
-    /** Effectively a look-up table:
-     * ' ', 'h', 'v', 'b' for empty, horizontal, vertical and both walls in the right and bottom part of a cell */
-    char walls[9][9]{};
-    bool wall_connections[8][8]{};    // Note: can be a bitmap to save up space (bools are 1 byte = 8 bits)
+    /** Bitboards: one row of the board per element, bit y for column y.
+     * hwalls/vwalls mark a (horizontal/vertical) wall in the bottom/right part of a cell. A wall covers two cells. */
+    unsigned short hwalls[9]{}, vwalls[9]{};
+    unsigned char wall_connections[8]{};    // bit y of row x: some wall has its middle at the bottom-right corner of (x, y)
     /** Whose turn it is to play: 'W' or 'B' */
     char turn;
-    /** Keep track of the distance from each player to each square while
-     * taking account for any walls */
-    short int **wdists;
-    short int **bdists;
+    /** Distance fields: length of the shortest path from every square to each player's goal row (-1 if cut off).
+     * Calculated on first use, then copied along with the state and repaired when a wall is placed. */
+    signed char wfield[9][9], bfield[9][9];
+    bool wfield_valid, bfield_valid;
     /** moves played */
     unsigned int move_counter;
-    /** randomness for rollouts */
-    static default_random_engine generator;
+    /** Zobrist hash of the position (updated incrementally by play_move()) */
+    unsigned long long zobrist;
+    /** Which moves the search tries: generate_all_moves() or only generate_good_moves() (a setting, not part of the position) */
+    bool test_all_moves;
+    static const unsigned long long *zobrist_keys();
     //////////////////////////////////////////
     char change_turn() { turn = (turn == 'W') ? 'B' : 'W'; return turn; }
-    bool horizontal_wall(short int x, short int y) const { return walls[x][y] == 'h' || walls[x][y] == 'b'; }
-    bool vertical_wall(short int x, short int y) const { return walls[x][y] == 'v' || walls[x][y] == 'b'; }
+    static bool on_board(short int x, short int y) { return x >= 0 && x < 9 && y >= 0 && y < 9; }
+    bool horizontal_wall(short int x, short int y) const { return on_board(x, y) && ((hwalls[x] >> y) & 1); }
+    bool vertical_wall(short int x, short int y) const { return on_board(x, y) && ((vwalls[x] >> y) & 1); }
+    bool connected_wall(short int x, short int y) const { return x >= 0 && x < 8 && y >= 0 && y < 8 && ((wall_connections[x] >> y) & 1); }
+    bool blocked(short int x, short int y, short int dx, short int dy) const { return blocked_by(hwalls, vwalls, x, y, dx, dy); }
+    static bool blocked_by(const unsigned short hw[9], const unsigned short vw[9], short int x, short int y, short int dx, short int dy);
     void add_wall(short int x, short int y, bool horizontal);
-    void remove_wall(short int x, short int y, bool horizontal);
+    void step_targets(char p, unsigned short targets[9]) const;
     bool legal_step(short int x, short int y, char p) const;
     bool legal_wall(short int x, short int y, char p, bool horizontal, bool check_blocking = true);
-    short int **calculate_dists_from(short int x, short int y, bool stop_at_goal, char player);
-    static void reset_dists(short int **&dists);
+    static bool flood_fill_step(const unsigned short reached[9], const unsigned short hw[9], const unsigned short vw[9], unsigned short next[9]);
+    static short int flood_fill_path(short int x, short int y, char player, const unsigned short hw[9], const unsigned short vw[9]);
+    static void calculate_field(char player, const unsigned short hw[9], const unsigned short vw[9], signed char field[9][9]);
+    static bool wall_keeps_distance(const signed char field[9][9], const unsigned short hw[9], const unsigned short vw[9],
+                                    const Quoridor_move *wall, short int posx, short int posy);
+    static bool find_lengthened(const signed char field[9][9], const unsigned short hw[9], const unsigned short vw[9],
+                                const Quoridor_move *wall, unsigned short lengthened[9]);
+    static void repair_field(signed char field[9][9], const unsigned short hw[9], const unsigned short vw[9], const unsigned short lengthened[9]);
+    const signed char (*distance_field(char player))[9];
+    void legal_step_moves(char p, vector<Quoridor_move> &moves) const;
+    void good_moves(vector<Quoridor_move> &moves);
+    void all_moves(vector<Quoridor_move> &moves);
 public:
     Quoridor_state();
     Quoridor_state(const Quoridor_state &other);
     ~Quoridor_state() override;
     char whose_turn() const { return turn; }
     unsigned int get_number_of_turns() const { return move_counter; }
+    void set_test_all_moves(bool all) { test_all_moves = all; }    // (inherited by the states that follow)
     char check_winner() const;
     short int remaining_walls(char p) const { return (p == 'W') ? wwallsno : bwallsno; }
     bool legal_move(const Quoridor_move *move);
@@ -75,16 +98,66 @@ public:
     /** Heuristics **/
     queue<MCTS_move *> *generate_good_moves();
     queue<MCTS_move *> *generate_all_moves();
+    /** Game hooks for MCTS_static_tree (by value) **/
+    void legal_moves(vector<Quoridor_move> &moves);
+    void play(const Quoridor_move &move) { play_move(&move); }
     friend bool force_playwall(Quoridor_state &s);
-    friend Quoridor_move *pick_semirandom_move(Quoridor_state &s, std::uniform_real_distribution<double> &dist, std::default_random_engine &gen);
+    friend Quoridor_move *pick_semirandom_move(Quoridor_state &s, std::uniform_real_distribution<double> &dist, MCTS_rng &gen,
+                                               vector<Quoridor_move> &pool);
     friend double evaluate_position(Quoridor_state &s, bool cheap);
+    friend class Quoridor_move_generator;
     /** Overrides: **/
     bool is_terminal() const override;
     MCTS_state *next_state(const MCTS_move *move) const override;
     queue<MCTS_move *> *actions_to_try() const override;
-    double rollout() const override;                        // the rollout simulation in MCTS
+    MCTS_move_generator *actions_generator() const override;
+    double rollout(MCTS_rng &rng) const override;           // the rollout simulation in MCTS
+    double rollout_with_moves(MCTS_rng &rng, vector<int> &played) const override;
+    void rollout_batch(unsigned int n, MCTS_rng *rngs, double *results, vector<int> *played) const override;
+    void action_priorities(const vector<MCTS_move *> &actions, vector<double> &priorities) const override;
     void print() const override;
     bool player1_turn() const override { return turn == 'W'; }
+    MCTS_state *clone() const override { return new Quoridor_state(*this); }
+    unsigned long long hash() const override;
+    unsigned long memory_usage() const override { return sizeof(Quoridor_state); }    // (!) no heap members
+};
+
+
+
+#define LINEAR_PATH_WEIGHT 0.04     // per step that black's shortest path is longer than white's (see Quoridor_linear_evaluator)
+#define LINEAR_WALL_WEIGHT 0.025    // per wall that white has left more than black
+#define LINEAR_TURN_WEIGHT 0.02     // if white is to move (minus if black is)
+#define LINEAR_MIN_VALUE 0.05
+#define LINEAR_LANES 4              // states whose values are computed together
+
+
+class Quoridor_move_generator : public MCTS_move_generator {
+    /** Incremental version of generate_all_moves(): step moves first, then every wall is checked (with BFS) only when we get to it */
+    Quoridor_state s;                  // (!) our own copy because legal_wall() temporarily places walls on the state
+    forward_list<MCTS_move *> steps;
+    unsigned int number_of_steps;      // left in steps
+    short int next_wall;               // walls are numbered (i * 8 + j) * 2 + k, k = 0 for horizontal
+public:
+    explicit Quoridor_move_generator(const Quoridor_state &state);
+    ~Quoridor_move_generator() override;
+    MCTS_move *next() override;
+    unsigned int max_number_of_moves() const override { return 12 + 128; }   // step moves + wall moves
+    unsigned long memory_usage() const override {       // (a list node holds a pointer to the next one and the move pointer)
+        return sizeof(*this) + number_of_steps * (2 * sizeof(void *) + sizeof(Quoridor_move));
+    }
+};
+
+
+class Quoridor_linear_evaluator final : public MCTS_leaf_evaluator {
+    /** White's winning chance as a linear function of the difference in shortest paths, the difference in walls left and
+     * whose turn it is, clamped to [LINEAR_MIN_VALUE, 1 - LINEAR_MIN_VALUE]. The shortest paths (BFS) are most of the cost;
+     * the values of a batch are then computed from its features LINEAR_LANES states at a time, which the compiler vectorizes. */
+    double path_weight, wall_weight, turn_weight;
+public:
+    explicit Quoridor_linear_evaluator(double path_weight = LINEAR_PATH_WEIGHT, double wall_weight = LINEAR_WALL_WEIGHT,
+                                       double turn_weight = LINEAR_TURN_WEIGHT)
+        : path_weight(path_weight), wall_weight(wall_weight), turn_weight(turn_weight) {}
+    void evaluate(const MCTS_state * const *states, unsigned int n, double *values) const override;
 };
 
 
@@ -4,7 +4,12 @@
 
 /** AI PARAMETERS **/
 #define MAXITER 20000
-#define MAXSECONDS 15
+#define MAXSECONDS 15               // per-move limit
+#define GAME_CLOCK_SECONDS 300      // each side's thinking time for the whole game
+#define SEARCH_THREADS 1            // > 1 for tree-parallel search (each thread then performs single rollouts)
+#define USE_TRANSPOSITIONS true     // share the nodes of positions reached by different move orders (serial search only)
+#define PONDER true                 // keep searching in the background after the AI's move until the next one is played
+#define PONDER_MAXITER (5 * MAXITER)    // (bounds the memory that a long wait can take)
 
 #define PROMPT "> "
 
@@ -17,6 +22,8 @@ const string commands = R"(Valid commands are:
   playmove or m <col><row>          -- plays a move for current player
   playwall or w <type> <col><row>   -- places a wall for current player
   genmove                           -- generates move for current player using MCTS
+  savebook <file> <depth>           -- saves the top levels of the AI's search tree as an opening book
+  loadbook <file>                   -- starts the AI's search from an opening book (now if no move has been searched, and after resets)
   clearboard or reset               -- resets the board)";
 
 
@@ -36,10 +43,17 @@ bool parse_coords(const string &s, int &x, int &y) {
 }
 
 
-int main() {
-    /** Important to set seed once. Quoridor_state won't do this! (TODO) **/
-    srand(time(NULL));
+void expected_rest_of_game(Quoridor_state *state, unsigned int &moves_left, double &importance) {
+    /** For the time manager: we still have to walk (at least) our shortest path and we will probably place our walls.
+     * Without walls there isn't much to think about and if the enemy has none left less thinking is required as well. */
+    char p = state->whose_turn(), enemy = (p == 'W') ? 'B' : 'W';
+    int path = state->get_shortest_path(p);
+    moves_left = (unsigned int) max(path, 1) + state->remaining_walls(p);
+    importance = (state->remaining_walls(p) == 0) ? 0.2 : (state->remaining_walls(enemy) == 0) ? 0.75 : 1.0;
+}
 
+
+int main() {
     cout << "============================================================" << endl
          << "===============╣    Welcome to Quoridor!    ╠===============" << endl
          << "============================================================" << endl << endl;
@@ -53,7 +67,10 @@ int main() {
         state->print();
     }
     /** Game Tree for AI (works for both sides) **/
-    MCTS_tree *game_tree = new MCTS_tree(new Quoridor_state());    // Important: do not use the same state that we change in main loop
+    MCTS_tree *game_tree = new MCTS_tree(new Quoridor_state(), USE_TRANSPOSITIONS);    // Important: do not use the same state that we change in main loop
+    MCTS_time_manager *white_clock = new MCTS_time_manager(GAME_CLOCK_SECONDS, 0.0, MAXSECONDS);
+    MCTS_time_manager *black_clock = new MCTS_time_manager(GAME_CLOCK_SECONDS, 0.0, MAXSECONDS);
+    MCTS_book book;                 // opening book (if loaded) for every new game
 
     cout << (state->whose_turn() == 'W' ? "White's move:" : "Black's move:") << endl << PROMPT;
     flush(cout);
@@ -131,18 +148,12 @@ int main() {
                 cin.ignore(512, '\n');
                 cout << "Game has already finished." << endl << endl;
             } else {
-                // determine "thinking time" required
-                double max_seconds = MAXSECONDS;
-                if (state->remaining_walls(state->whose_turn()) == 0) {
-                    // if can't play a wall then there isn't much to think about
-                    max_seconds = (max_seconds >= 5) ? 2.5 : max_seconds / 2;
-                } else if (state->remaining_walls(state->whose_turn() == 'W' ? 'B' : 'W') == 0) {
-                    // if enemy can't play a wall then less thinking is probably required as well
-                    max_seconds = 0.75 * max_seconds;
-                }
-
-                // grow tree by thinking ahead and sampling monte carlo rollouts
-                game_tree->grow_tree(MAXITER, max_seconds);
+                // grow tree by thinking ahead and sampling monte carlo rollouts (for as long as the player's clock allows)
+                unsigned int moves_left;
+                double importance;
+                expected_rest_of_game(state, moves_left, importance);
+                MCTS_time_manager *clock = (state->whose_turn() == 'W') ? white_clock : black_clock;
+                clock->think(game_tree, MAXITER, moves_left, importance, SEARCH_THREADS);
                 game_tree->print_stats();   // debug
 
                 // select best child node at root level
@@ -166,22 +177,56 @@ int main() {
 
                 // check if winning move
                 winner = state->check_winner();
+                // think on the opponent's time (playmove, playwall and genmove keep what it finds)
+                if (PONDER && winner == ' ') {
+                    game_tree->start_pondering(PONDER_MAXITER, SEARCH_THREADS);
+                }
             }
         } else if (command == "stats") {
+            game_tree->stop_pondering();
             game_tree->print_stats();
         }
+        else if (command == "savebook") {
+            string path;
+            unsigned int depth;
+            if (!(cin >> path >> depth)) {
+                cin.clear();
+                cin.ignore(512, '\n');
+                cout << "Invalid command: Invalid arguments" << endl << endl;
+            } else {
+                game_tree->stop_pondering();
+                if (game_tree->save_book(path, depth)) {
+                    cout << "Saved the top " << depth << " levels of the search tree to " << path << endl << endl;
+                }
+            }
+        }
+        else if (command == "loadbook") {
+            string path;
+            cin >> path;
+            if (book.open(path)) {
+                game_tree->stop_pondering();
+                cout << "Opening book of " << book.size() << " positions: added " << game_tree->load_book(book)
+                     << " of them to the search tree" << endl << endl;
+            }
+        }
         else if (command == "clearboard" || command == "reset") {
             delete state;
             state = new Quoridor_state();
             delete game_tree;
-            game_tree = new MCTS_tree(new Quoridor_state());
+            game_tree = new MCTS_tree(new Quoridor_state(), USE_TRANSPOSITIONS);
+            game_tree->load_book(book);
+            delete white_clock;
+            delete black_clock;
+            white_clock = new MCTS_time_manager(GAME_CLOCK_SECONDS, 0.0, MAXSECONDS);
+            black_clock = new MCTS_time_manager(GAME_CLOCK_SECONDS, 0.0, MAXSECONDS);
         }
         else if (command == "rollout") {   // for debug
             double res = 0.0;
             int num;
             cin >> num;
+            MCTS_rng rng((unsigned long long) time(NULL));
             for (int i = 0 ; i < num ; i++) {
-                res += state->rollout();
+                res += state->rollout(rng);
             }
             double score = res / num;
             cout << "Rollout average score: " << setprecision(4) << 100.0 * score << endl;
@@ -201,6 +246,8 @@ int main() {
     }
     delete state;
     delete game_tree;
+    delete white_clock;
+    delete black_clock;
     return 0;
 }
 
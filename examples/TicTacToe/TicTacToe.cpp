@@ -45,32 +45,46 @@ void TicTacToe_state::change_turn() {
     turn = (turn == 'x') ? 'o' : 'x';
 }
 
+bool TicTacToe_state::play(const TicTacToe_move &move) {
+    if (board[move.x][move.y] != ' ') {
+        cerr << "Warning: Illegal move (" << move.x << ", " << move.y << ")" << endl;
+        return false;
+    }
+    board[move.x][move.y] = move.player;     // play move
+    winner = calculate_winner();             // check again for a winner
+    change_turn();
+    return true;
+}
+
 MCTS_state *TicTacToe_state::next_state(const MCTS_move *move) const {
     // Note: We have to manually cast it to its correct type
-    TicTacToe_move *m = (TicTacToe_move *) move;
     TicTacToe_state *new_state = new TicTacToe_state(*this);  // create new state from current
-    if (new_state->board[m->x][m->y] == ' ') {
-        new_state->board[m->x][m->y] = m->player;             // play move
-        new_state->winner = new_state->calculate_winner();    // check again for a winner
-        new_state->change_turn();
-    } else {
-        cerr << "Warning: Illegal move (" << m->x << ", " << m->y << ")" << endl;
+    if (!new_state->play(*(const TicTacToe_move *) move)) {
+        delete new_state;
         return NULL;
     }
     return new_state;
 }
 
-queue<MCTS_move *> *TicTacToe_state::actions_to_try() const {
-    queue<MCTS_move *> *Q = new queue<MCTS_move *>();
+void TicTacToe_state::legal_moves(vector<TicTacToe_move> &moves) const {
     for (int i = 0 ; i < 9 ; i++) {
         if (board[i / 3][i % 3] == ' ') {
-            Q->push(new TicTacToe_move(i / 3, i % 3, turn));
+            moves.push_back(TicTacToe_move(i / 3, i % 3, turn));
         }
     }
+}
+
+queue<MCTS_move *> *TicTacToe_state::actions_to_try() const {
+    queue<MCTS_move *> *Q = new queue<MCTS_move *>();
+    vector<TicTacToe_move> moves;
+    legal_moves(moves);
+    for (const TicTacToe_move &m : moves) {
+        Q->push(new TicTacToe_move(m));
+    }
     return Q;
 }
 
-double TicTacToe_state::rollout() const {
+double TicTacToe_state::rollout(MCTS_rng &rng) const {
     if (is_terminal()) return (winner == 'x') ? 1.0 : (winner == 'd') ? 0.5 : 0.0;
     // Simulate a completely random game
     // Note: dequeue is not very efficient for random accesses but vector is not efficient for deletes
@@ -80,30 +94,20 @@ double TicTacToe_state::rollout() const {
             available.push_front(i);
         }
     }
-    long long r;
+    unsigned long long r;
     int a;
-    TicTacToe_state *curstate = (TicTacToe_state *) this;   // TODO: ignore const...
-    srand(time(NULL));
-    bool first = true;
+    TicTacToe_state curstate(*this);        // played on in place
     do {
         if (available.empty()) {
             cerr << "Warning: Ran out of available moves and state is not terminal?";
             return 0.0;
         }
-        r = rand() % available.size();
+        r = rng() % available.size();
         a = available[r];
-        TicTacToe_move move(a / 3, a % 3, curstate->turn);
         available.erase(available.begin() + r);    // delete from available moves
-        TicTacToe_state *old = curstate;
-        curstate = (TicTacToe_state *) curstate->next_state(&move);
-        if (!first) {
-            delete old;
-        }
-        first = false;
-    } while (!curstate->is_terminal());
-    double res = (curstate->winner == 'x') ? 1.0 : (curstate->winner == 'd') ? 0.5 : 0.0;
-    delete curstate;
-    return res;
+        curstate.play(TicTacToe_move(a / 3, a % 3, curstate.turn));
+    } while (!curstate.is_terminal());
+    return (curstate.winner == 'x') ? 1.0 : (curstate.winner == 'd') ? 0.5 : 0.0;
 }
 
 void TicTacToe_state::print() const {
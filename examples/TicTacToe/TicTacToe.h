@@ -2,9 +2,13 @@
 #define MCTS_TICTACTOE_H
 
 #include "../../mcts/include/state.h"
+#include <vector>
 
 
-class TicTacToe_state : public MCTS_state {
+struct TicTacToe_move;
+
+
+class TicTacToe_state final : public MCTS_state {
     char board[3][3]{};
     bool player_won(char player) const;
     char calculate_winner() const;
@@ -15,20 +19,26 @@ public:
     TicTacToe_state(const TicTacToe_state &other);
     char get_turn() const;
     char get_winner() const;
+    /** Game hooks for MCTS_static_tree (by value) **/
+    void legal_moves(vector<TicTacToe_move> &moves) const;
+    bool play(const TicTacToe_move &move);
     bool is_terminal() const override;
     MCTS_state *next_state(const MCTS_move *move) const override;
     queue<MCTS_move *> *actions_to_try() const override;
-    double rollout() const override;                        // the rollout simulation in MCTS
+    double rollout(MCTS_rng &rng) const override;              // the rollout simulation in MCTS
     void print() const override;
     bool player1_turn() const override { return turn == 'x'; }
+    MCTS_state *clone() const override { return new TicTacToe_state(*this); }
+    unsigned long memory_usage() const override { return sizeof(TicTacToe_state); }
 };
 
 
-struct TicTacToe_move : public MCTS_move {
+struct TicTacToe_move final : public MCTS_move {
     int x, y;
     char player;
     TicTacToe_move(int x, int y, char p) : x(x), y(y), player(p) {}
     bool operator==(const MCTS_move& other) const override;
+    unsigned long memory_usage() const override { return sizeof(TicTacToe_move); }
 };
 
 #endif
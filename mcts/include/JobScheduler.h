@@ -2,6 +2,7 @@
 #define JOBSCHEDULER_H
 
 #include <queue>
+#include <chrono>
 #include <unordered_map>
 #include <pthread.h>
 #include <stdlib.h>
@@ -17,12 +18,22 @@ using namespace std;
 class Job {                                  // extend this to whatever job you want scheduled (in a different .cpp/.h)
 public:
     const int TAG;                           // used to group waiting for different jobs
+    chrono::steady_clock::time_point scheduled_at;    // (only set while the scheduler collects its stats)
     Job(int tag = NOTAG) : TAG(tag) {}
     virtual ~Job() {}
     virtual void run() = 0;                  // must be thread_safe
 };
 
 
+struct SchedulerStats {                      // protected by the scheduler's queue_lock (only collected after set_stats(true))
+    unsigned long jobs;                      // taken off the queue
+    unsigned long long queue_wait_ns;        // from schedule() until a worker took them
+    unsigned long lock_acquisitions;         // by schedule() and the workers (not by those waiting for jobs to finish)
+    unsigned long long lock_hold_ns;         // by them (not counting condition waits)
+    SchedulerStats() : jobs(0), queue_wait_ns(0), lock_acquisitions(0), lock_hold_ns(0) {}
+};
+
+
 struct thread_args {
     queue <Job *> *jobQueue;
     pthread_mutex_t *queueLock;
@@ -31,9 +42,13 @@ struct thread_args {
     volatile bool *threads_must_exit;
     pthread_cond_t *jobs_finished_cond;
     unordered_map<int, volatile unsigned int> *tagged_jobs_pending;
+    SchedulerStats *stats;
+    bool *collect_stats;
     thread_args(queue<Job *> *_jobQueue, pthread_mutex_t *_queueLock, pthread_cond_t *_queueCond,
-                volatile unsigned int *_jobsRunning, volatile bool *_threads_must_exit, pthread_cond_t *_jobs_finished_cond, unordered_map<int, volatile unsigned int> *_tagged_jobs_pending)
-            : jobQueue(_jobQueue), queueLock(_queueLock), queueCond(_queueCond), jobsRunning(_jobsRunning), threads_must_exit(_threads_must_exit), jobs_finished_cond(_jobs_finished_cond), tagged_jobs_pending(_tagged_jobs_pending) {}
+                volatile unsigned int *_jobsRunning, volatile bool *_threads_must_exit, pthread_cond_t *_jobs_finished_cond, unordered_map<int, volatile unsigned int> *_tagged_jobs_pending,
+                SchedulerStats *_stats, bool *_collect_stats)
+            : jobQueue(_jobQueue), queueLock(_queueLock), queueCond(_queueCond), jobsRunning(_jobsRunning), threads_must_exit(_threads_must_exit), jobs_finished_cond(_jobs_finished_cond), tagged_jobs_pending(_tagged_jobs_pending),
+              stats(_stats), collect_stats(_collect_stats) {}
 };
 
 void *thread_code(void *args);
@@ -53,6 +68,8 @@ class JobScheduler {
     pthread_cond_t jobs_finished_cond;
     volatile unsigned int jobs_running;      // protected by queue_lock
     unordered_map<int, volatile unsigned int> tagged_jobs_pending;   // tag -> number of jobs
+    SchedulerStats stats;                    // protected by queue_lock
+    bool collect_stats;                      // protected by queue_lock (off by default: reading the clock costs a little per job)
 public:
     JobScheduler(unsigned int _number_of_threads = NUMBER_OF_THREADS);
     ~JobScheduler();                         // Waits until all jobs have finished!
@@ -60,6 +77,9 @@ public:
     bool JobsHaveFinished(int tag = NOTAG);
     void waitUntilJobsHaveFinished(int taf = NOTAG);
     unsigned int get_number_of_threads() const { return number_of_threads; }
+    void set_stats(bool on);                 // whether to collect stats (see MCTS_tree's SEARCH_STATS)
+    SchedulerStats get_stats();
+    void reset_stats();
 };
 
 #endif
@@ -0,0 +1,80 @@
+#ifndef WORKSTEALINGSCHEDULER_H
+#define WORKSTEALINGSCHEDULER_H
+
+#include <atomic>
+#include <unordered_map>
+#include <pthread.h>
+#include "JobScheduler.h"                    // Job, NOTAG and NUMBER_OF_THREADS
+
+
+#define WORKER_QUEUE_CAPACITY 1024           // jobs per worker queue (must be a power of 2)
+#define SPINS_BEFORE_SLEEPING 4096           // how long an idle worker keeps looking for jobs before it blocks
+#define CACHE_LINE 64
+
+
+using namespace std;
+
+
+class WorkerQueue {
+    /** Bounded lock-free queue of a single worker. Jobs are pushed by the scheduling thread(s) (one at a time
+     * thanks to push_lock) and taken from the other end by the worker that owns it as well as by idle workers
+     * that steal from it (lock-free, with a CAS on top). */
+    atomic<Job *> jobs[WORKER_QUEUE_CAPACITY];
+    char pad0[CACHE_LINE];
+    atomic<unsigned long> top;               // next job to be taken
+    char pad1[CACHE_LINE];
+    atomic<unsigned long> bottom;            // next free slot
+    atomic_flag push_lock = ATOMIC_FLAG_INIT;
+    char pad2[CACHE_LINE];
+public:
+    WorkerQueue() : top(0), bottom(0) {}
+    unsigned int push(Job *const *batch, unsigned int n);    // returns how many jobs fit
+    Job *take();                                              // returns NULL if empty
+    bool empty() const { return top.load() >= bottom.load(); }
+};
+
+
+class WorkStealingScheduler;
+
+struct worker_args {
+    WorkStealingScheduler *scheduler;
+    unsigned int id;                         // index of the worker's own queue
+};
+
+
+class WorkStealingScheduler {
+    /** Drop-in alternative to JobScheduler for many threads and small jobs:
+     * - every worker has its own queue and steals from the others' when it runs out of jobs
+     * - no mutex on the hot path (only idle workers sleep and only tagged jobs need a lock for their counters)
+     * - (!) scheduled jobs are NOT deleted: they only have to stay alive until they have finished so they
+     *   can live on the stack (see MCTS_node::rollout) */
+    pthread_t *threads;
+    const unsigned int number_of_threads;
+    WorkerQueue *queues;
+    worker_args *w_args;
+    atomic<bool> threads_must_exit;
+    atomic<unsigned int> next_queue;         // round robin over worker queues for new jobs
+    /* Sleeping workers */
+    atomic<unsigned int> sleepers;
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t work_cond;                // signaled when jobs are scheduled and someone sleeps
+    /* Job Info */
+    atomic<unsigned int> jobs_pending;       // scheduled and not yet finished
+    pthread_mutex_t jobs_lock;               // protects tagged_jobs_pending and waiting
+    pthread_cond_t jobs_finished_cond;
+    unordered_map<int, unsigned int> tagged_jobs_pending;    // tag -> number of jobs
+    void worker_loop(unsigned int id);
+    Job *find_job(unsigned int id);
+    void job_finished(int tag);
+    static void *thread_code(void *args);
+public:
+    WorkStealingScheduler(unsigned int _number_of_threads = NUMBER_OF_THREADS);
+    ~WorkStealingScheduler();                // Waits until all jobs have finished!
+    void schedule(Job *job);
+    void schedule_batch(Job *const *jobs, unsigned int n);
+    bool JobsHaveFinished(int tag = NOTAG);
+    void waitUntilJobsHaveFinished(int tag = NOTAG);
+    unsigned int get_number_of_threads() const { return number_of_threads; }
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef MCTS_BOOK_H
+#define MCTS_BOOK_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define BOOK_VERSION 1
+#define BOOK_HASHES 1                        // header flag: the records carry the hash() of their states
+
+
+using namespace std;
+
+
+/** File format of an opening book (see MCTS_tree::save_book): a header followed by one record per node, breadth-first from
+ * the root (record 0) so that the children of a node are contiguous and come after it. Byte order is the writer's: a book
+ * from a machine of the other endianness is rejected because its version does not match. */
+struct MCTS_book_header {
+    char magic[8];                           // "MCTSBOOK"
+    uint32_t version;
+    uint32_t flags;
+    uint64_t number_of_records;
+};
+
+struct MCTS_book_record {
+    uint64_t hash;                           // of the node's state (0 if not stored or the state is not hashed)
+    double score;                            // as in MCTS_node: the sum of player 1's results
+    uint32_t visits;                         // (> 0)
+    int32_t move_id;                         // MCTS_move::id() of the move that leads here (-1 for the root)
+    uint32_t first_child;                    // index of the record of the first child
+    uint32_t number_of_children;
+};
+
+
+class MCTS_book {
+    /** Read-only opening book: the file is memory-mapped and its records are read in place (checked once when opened) */
+    void *data;
+    size_t length;
+    const MCTS_book_header *header;
+    const MCTS_book_record *records;
+public:
+    MCTS_book() : data(NULL), length(0), header(NULL), records(NULL) {}
+    MCTS_book(const MCTS_book &) = delete;
+    MCTS_book &operator=(const MCTS_book &) = delete;
+    ~MCTS_book() { close(); }
+    bool open(const string &path);           // false (with a warning) if the file cannot be mapped or is not a valid book
+    void close();
+    bool is_open() const { return records != NULL; }
+    bool has_hashes() const { return is_open() && (header->flags & BOOK_HASHES) != 0; }
+    size_t size() const { return is_open() ? (size_t) header->number_of_records : 0; }
+    const MCTS_book_record *root() const { return records; }
+    const MCTS_book_record *child(const MCTS_book_record *r, unsigned int i) const { return records + r->first_child + i; }
+    static bool write(const string &path, const vector<MCTS_book_record> &records, bool hashes);
+};
+
+
+#endif
@@ -4,47 +4,223 @@
 #include "state.h"
 #include <vector>
 #include <queue>
+#include <unordered_map>
 #include <iomanip>
+#include <atomic>
+#include <ctime>
+#include <chrono>
+#include <climits>
+#include <functional>
 #include "JobScheduler.h"
+#include "WorkStealingScheduler.h"
+#include "book.h"
 
 
-#define STARTING_NUMBER_OF_CHILDREN 32   // expected number so that we can preallocate this many pointers
+#define ARENA_SLAB_SIZE 4096             // nodes allocated at once by a tree's node arena
+#define ARENA_MAX_SLABS 16384            // (!) i.e. up to ~67M nodes per tree
+#define CHILDREN_BLOCK 2                 // slots of a node's first block of children: every further block is twice as big
+#define CHILDREN_MAX_BLOCKS 6            // the last of them takes all the remaining moves (see MCTS_node::claim_child_slot)
 #define PARALLEL_ROLLOUTS                // whether or not to do multiple parallel rollouts
+#define ROLLOUTS_PER_ITERATION NUMBER_OF_THREADS  // with PARALLEL_ROLLOUTS: run in one batch per rollout worker (at most a worker per core)
+#define EXPLORATION_CONSTANT 1.41        // c of UCT (see MCTS_tree::set_exploration)
+#define BACKGROUND_RECLAMATION           // whether subtrees discarded by advance_tree() are destructed by a background thread
+#define VIRTUAL_LOSS 1                   // losses temporarily added to a node for each thread searching below it (tree-parallel mode)
+#define PIPELINE_DEPTH_PER_THREAD 2      // rollouts in flight per worker thread (pipelined mode)
+#define DEADLINE_CHECK_PERIOD 0.0005     // seconds between two reads of the clock while searching (see MCTS_deadline)
+#define DEADLINE_MAX_CHECK_INTERVAL 4096 // but never more iterations than this between them
+#define TIME_SLICE 0.1                   // the time manager looks at the root this often (fraction of a move's time budget)
+#define TIME_MAX_EXTENSION 2.5           // an unstable search may take up to this many times its budget
+#define TIME_SAFETY_MARGIN 0.05          // seconds of the game clock that are never spent (latency of everything else)
+#define PRUNE_TO 0.75                    // pruning shrinks a tree that exceeds its memory budget to this fraction of it
+#define WIDENING_COEFFICIENT 1.0         // progressive widening: a node with n visits may have up to coefficient * n^exponent
+#define WIDENING_EXPONENT 0.5            // children (see MCTS_tree::set_progressive_widening)
+#define RAVE_EQUIVALENCE 500             // visits at which a move's own and its all-moves-as-first statistics weigh the same
+#define EVALUATION_BATCH 16              // leaves per call of a leaf evaluator (see MCTS_tree::set_leaf_evaluator)
+#define EVALUATION_MAX_LATENCY 0.002     // seconds that a batch may take to fill up before it is evaluated anyway
+// #define SEARCH_STATS                  // per-phase counters and timers of the search and its schedulers (see MCTS_search_stats)
+
+
+enum search_mode {
+    SERIAL_SEARCH,                           // one thread grows the tree (rollouts may still be parallel, see PARALLEL_ROLLOUTS)
+    TREE_PARALLEL_SEARCH,                    // many threads grow the same tree using virtual loss
+    ROOT_PARALLEL_SEARCH,                    // many threads grow independent trees whose root statistics get merged
+    PIPELINED_SEARCH                         // one thread grows the tree while rollouts run asynchronously on the others
+};
+
+inline bool uses_virtual_loss(search_mode mode) { return mode == TREE_PARALLEL_SEARCH || mode == PIPELINED_SEARCH; }
+
+enum proof_status : unsigned char {          // MCTS-Solver: the game-theoretic value of a node once it is known
+    UNPROVEN,
+    PROVEN_P1_WIN,
+    PROVEN_P2_WIN,
+    PROVEN_DRAW
+};
 
 
 using namespace std;
 
 /** Ideas for improvements:
  * - state should probably be const like move is (currently problematic because of Quoridor's example)
- * - Instead of a FIFO Queue use a Priority Queue with priority on most probable (better) actions to be explored first
-  or maybe this should just be an iterable and we let the implementation decide but these have no superclasses in C++ it seems
  * - vectors, queues and these structures allocate data on the heap anyway so there is little point in using the heap for them
  * so use stack instead?
  */
 
 
+class SpinLock {                              // tiny lock for the (very short) critical sections of a single node
+    atomic_flag flag = ATOMIC_FLAG_INIT;
+public:
+    void lock() { while (flag.test_and_set(memory_order_acquire)) ; }
+    void unlock() { flag.clear(memory_order_release); }
+};
+
+
+class MCTS_arena;
+
+
+struct MCTS_search_stats {                   // where a search spends its time (see MCTS_tree::get_search_stats)
+    double seconds;                          // in grow_tree()
+    unsigned long iterations;
+    unsigned long selections, selection_depth, max_selection_depth;    // depth summed over all selections
+    double selection_seconds;
+    unsigned long expansions;
+    double expansion_seconds, generation_seconds, next_state_seconds;   // the last two are part of expansion
+    unsigned long rollouts, rollout_plies;   // plies as reported by MCTS_state::rollout_with_moves() (only called for RAVE)
+    double rollout_seconds;
+    unsigned long backpropagations;
+    double backpropagation_seconds;
+    unsigned long solved_visits;             // of terminal or proven nodes (backpropagated without a rollout, see MCTS-Solver)
+    unsigned long evaluations, evaluation_batches;     // leaves evaluated instead of rolled out (see MCTS_leaf_evaluator)
+    double evaluation_seconds;
+    unsigned long scheduler_jobs, scheduler_lock_acquisitions;     // JobScheduler of parallel search (see SchedulerStats)
+    double scheduler_queue_wait_seconds, scheduler_lock_hold_seconds;
+    MCTS_search_stats()
+        : seconds(0.0), iterations(0), selections(0), selection_depth(0), max_selection_depth(0), selection_seconds(0.0),
+          expansions(0), expansion_seconds(0.0), generation_seconds(0.0), next_state_seconds(0.0), rollouts(0), rollout_plies(0),
+          rollout_seconds(0.0), backpropagations(0), backpropagation_seconds(0.0), solved_visits(0),
+          evaluations(0), evaluation_batches(0), evaluation_seconds(0.0), scheduler_jobs(0), scheduler_lock_acquisitions(0),
+          scheduler_queue_wait_seconds(0.0), scheduler_lock_hold_seconds(0.0) {}
+    void print() const;
+    string to_json() const;                  // one line
+};
+
+
+struct MCTS_search_counters {                // what the threads of a search add up for MCTS_search_stats (times in nanoseconds)
+    atomic<unsigned long long> search_ns, iterations, selections, selection_depth, max_selection_depth, selection_ns,
+                               expansions, expansion_ns, generation_ns, next_state_ns, rollouts, rollout_plies, rollout_ns,
+                               backpropagations, backpropagation_ns, solved_visits, evaluations, evaluation_batches, evaluation_ns;
+    MCTS_search_counters() { reset(); }
+    void reset();
+};
+
+
+class MCTS_node;
+
+
+struct MCTS_garbage {                         // what advance_tree() discards: nodes to destruct, then arena blocks to release
+    vector<MCTS_node *> nodes;
+    vector<pair<unsigned int, unsigned int>> blocks;     // (first node, number of nodes)
+};
+
+
+class MCTS_deadline {                         // when a search has to stop: monotonic clock, sub-millisecond precision
+    typedef chrono::steady_clock clock;
+    clock::time_point start, end, last_check;
+    unsigned int interval, countdown;         // iterations between reads of the clock (adapted to how long they take)
+    const atomic<bool> *interrupt;            // if not NULL the search also stops as soon as this is set (see stop_pondering)
+public:
+    explicit MCTS_deadline(double seconds, const atomic<bool> *interrupt = NULL)
+        : start(clock::now()), end(start + chrono::duration_cast<clock::duration>(chrono::duration<double>(min(seconds, 1e9)))),
+          last_check(start), interval(1), countdown(1), interrupt(interrupt) {}
+    double elapsed() const { return chrono::duration<double>(clock::now() - start).count(); }
+    double remaining() const { return chrono::duration<double>(end - clock::now()).count(); }
+    bool interrupted() const { return interrupt != NULL && interrupt->load(memory_order_relaxed); }
+    bool expired() const { return interrupted() || clock::now() >= end; }
+    bool poll();                              // call once per iteration: reads the clock only every few calls
+};
+
+
+/** Note: node statistics are atomic so that multiple threads can grow the same tree (see MCTS_tree::grow_tree).
+ * In the default single-threaded mode these are uncontended and cost (almost) nothing.
+ * Nodes live in their tree's MCTS_arena: the children of a node are a few contiguous blocks of nodes there, allocated as they
+ * fill up (CHILDREN_BLOCK slots, then twice as many etc) so that a node with a few children does not hold a slot for every move. */
 class MCTS_node {
     bool terminal;
-    unsigned int size;
-    unsigned int number_of_simulations;
-    double score;                       // e.g. number of wins (could be int but double is more general if we use evaluation functions)
-    MCTS_state *state;                  // current state
+    atomic<bool> ready;                 // slot has been initialized and the node's first rollout is done
+    atomic<proof_status> proof;         // MCTS-Solver: set once, by a terminal state's result or by our children's proofs
+    atomic<unsigned int> size;
+    atomic<unsigned int> number_of_simulations;
+    atomic<double> score;               // e.g. number of wins (could be int but double is more general if we use evaluation functions)
+    atomic<unsigned int> virtual_loss;  // pending visits from threads currently searching below this node
+    atomic<unsigned int> amaf_visits;   // RAVE: rollouts through our parent that played our move later on (see update_amaf)
+    atomic<double> amaf_score;          // and their score
+    bool player1;                       // whose turn it is in our state (which we may not keep)
+    unsigned int depth;                 // plies from the start of the game
+    atomic<MCTS_state *> state;         // current state or NULL if it is not kept: see MCTS_tree::set_checkpoints
     const MCTS_move *move;              // move to get here from parent node's state
-    vector<MCTS_node *> *children;
-    MCTS_node *parent;
-    queue<MCTS_move *> *untried_actions;
-    void backpropagate(double w, int n);
+    MCTS_arena *arena;                  // where this node and its children live
+    unsigned int children_blocks[CHILDREN_MAX_BLOCKS];   // arena index of each block of children (see child())
+    unsigned int children_capacity;     // slots in the blocks allocated so far
+    unsigned int max_children;          // max_number_of_moves() of our first move generator (0 until it exists)
+    atomic<unsigned int> number_of_children;   // slots claimed so far (only ready ones are visible to select_best_child)
+    int move_id;                        // move->id() (-1 if none)
+    MCTS_node *parent;                  // (!) for a shared node: the parent we last reached it from (see MCTS_tree::select)
+    MCTS_node *transposition;           // if not NULL this slot is just an edge to the node of the same state elsewhere
+    unsigned long long hash;            // of state (0 if not hashed)
+    MCTS_move_generator *untried_actions;   // (!) NULL until the node is first expanded
+    MCTS_move *next_action;             // next untried action (generated one step ahead so that we know when we run out)
+    unsigned int generated_actions;     // moves taken from our move generator so far (UINT_MAX if it can't be created again)
+    atomic<bool> all_actions_claimed;   // no untried actions left (the last one may still be under expansion by some thread)
+    SpinLock expansion_lock;            // protects untried_actions, next_action and claiming child slots
+    void backpropagate(double w, int n, unsigned int vl);
+    void update_amaf(const vector<int> &played, double w);
+    void prove(proof_status p);
+    void rollout_solved(MCTS_rng &rng, search_mode mode);
+    void update_proof();
+    bool wins_for_us(proof_status p) const;
+    MCTS_node *child(unsigned int i) const;
+    static unsigned int children_block_of(unsigned int i);
+    unsigned int children_block_size(unsigned int k) const;
+    MCTS_node *claim_child_slot();
+    void generate_untried_actions(const MCTS_state *s);
+    void release_children();
+    MCTS_move *claim_untried_action(const MCTS_state *s);
+    void take_untried_actions(const function<bool(const MCTS_move *)> &matches, vector<MCTS_move *> &taken);
+    bool remove_untried_action(const MCTS_move *m);
+    unsigned int seed(const MCTS_book &book, const MCTS_book_record *record, unsigned int levels);
+    void detach_children();
+    void account(long long bytes) const;
+    MCTS_move *next_untried_action();
+    void delete_move(const MCTS_move *m) const;
+    void delete_untried_actions();
+    void collapse();
+    MCTS_state *replay_state() const;
+    const MCTS_state *acquire_state(MCTS_state *&scratch);
+    void keep_state();
+    void drop_state();
+    void relocate_to(MCTS_node *slot);
+    void share(MCTS_node *shared);
+    const MCTS_node *resolve() const { return (transposition != NULL) ? transposition : this; }
+    friend class MCTS_tree;
+    friend class MCTS_time_manager;
 public:
-    MCTS_node(MCTS_node *parent, MCTS_state *state, const MCTS_move *move);
+    MCTS_node();                        // an empty slot of the arena
     ~MCTS_node();
+    void init(MCTS_arena *arena, MCTS_node *parent, MCTS_state *state, const MCTS_move *move);
     bool is_fully_expanded() const;
+    bool is_expandable() const;         // not fully expanded and (with progressive widening) allowed another child
     bool is_terminal() const;
+    bool is_proven() const { return proof.load(memory_order_acquire) != UNPROVEN; }
+    proof_status get_proof() const { return proof.load(memory_order_acquire); }
     const MCTS_move *get_move() const;
     unsigned int get_size() const;
-    void expand();
-    void rollout();
+    void expand(MCTS_rng &rng, search_mode mode = SERIAL_SEARCH);
+    MCTS_node *add_child(search_mode mode);
+    void rollout(MCTS_rng &rng, search_mode mode = SERIAL_SEARCH);
+    void complete_rollout(double w, search_mode mode);
+    void add_virtual_loss() { virtual_loss += VIRTUAL_LOSS; }
+    void merge_root(MCTS_node *other);
     MCTS_node *select_best_child(double c) const;
-    MCTS_node *advance_tree(const MCTS_move *m);
+    MCTS_node *advance_tree(const MCTS_move *m, unsigned int &block, unsigned int &block_size, MCTS_garbage &garbage);
     const MCTS_state *get_current_state() const;
     void print_stats() const;
     double calculate_winrate(bool player1turn) const;
@@ -52,41 +228,300 @@ public:
 
 
 
+class MCTS_arena {
+    /** Allocates nodes in contiguous slabs so that a tree needs a handful of mallocs instead of a few per node.
+     * Nodes are addressed by index. Blocks of discarded nodes are recycled through free lists (by block size). */
+    MCTS_node *slabs[ARENA_MAX_SLABS];
+    unsigned int number_of_slabs;
+    unsigned int next_free;                  // index of the first never-used node in the last slab
+    vector<vector<unsigned int>> free_blocks;    // block size -> indices of free blocks of that size
+    SpinLock lock;
+    /** Memory accounting: nodes in allocated blocks plus what the states, moves and move generators owned by them report */
+    atomic<unsigned long> nodes_in_use;
+    atomic<long long> owned_bytes;
+    unsigned long budget;                    // 0 for none
+    /** Which of the nodes keep their state (see MCTS_tree::set_checkpoints) */
+    unsigned int checkpoint_interval, checkpoint_visits;
+    /** Progressive widening (see MCTS_tree::set_progressive_widening): coefficient 0 for none */
+    double widening_coefficient, widening_exponent;
+    /** RAVE (see MCTS_tree::set_rave): 0 for none */
+    unsigned int rave_equivalence;
+    /** Search parameters (see MCTS_tree::set_exploration and set_rollouts_per_leaf) */
+    double exploration;
+    unsigned int rollouts_per_leaf;          // 0 for the default
+public:
+    MCTS_search_counters stats;              // of the current search (only collected with SEARCH_STATS)
+    MCTS_arena();
+    ~MCTS_arena();                           // (!) frees all slabs at once. Nodes must have been destructed before.
+    unsigned int allocate(unsigned int n);   // returns the index of the first of n contiguous empty nodes
+    void release(unsigned int first, unsigned int n);
+    MCTS_node *at(unsigned int i) const { return slabs[i / ARENA_SLAB_SIZE] + (i % ARENA_SLAB_SIZE); }
+    unsigned int get_number_of_slabs() const { return number_of_slabs; }
+    void account(long long bytes) { owned_bytes += bytes; }
+    unsigned long get_memory_usage() const { return nodes_in_use * sizeof(MCTS_node) + (unsigned long) owned_bytes.load(); }
+    void set_budget(unsigned long bytes) { budget = bytes; }
+    unsigned long get_budget() const { return budget; }
+    bool over_budget() const { return budget > 0 && get_memory_usage() > budget; }
+    void set_checkpoints(unsigned int interval, unsigned int visits) { checkpoint_interval = interval; checkpoint_visits = visits; }
+    unsigned int get_checkpoint_interval() const { return checkpoint_interval; }
+    unsigned int get_checkpoint_visits() const { return checkpoint_visits; }
+    void set_widening(double coefficient, double exponent) { widening_coefficient = coefficient; widening_exponent = exponent; }
+    bool widening() const { return widening_coefficient > 0.0; }
+    unsigned int widening_limit(unsigned int visits) const;     // children a node with that many visits may have
+    void set_rave(unsigned int equivalence) { rave_equivalence = equivalence; }
+    unsigned int get_rave_equivalence() const { return rave_equivalence; }
+    void set_exploration(double c) { exploration = c; }
+    double get_exploration() const { return exploration; }
+    void set_rollouts_per_leaf(unsigned int n) { rollouts_per_leaf = n; }
+    unsigned int get_rollouts_per_leaf() const { return rollouts_per_leaf; }
+};
+
+
+class MCTS_time_manager;
+
+
 class MCTS_tree {
+    MCTS_arena *arena;
     MCTS_node *root;
+    unsigned int root_block, root_block_size;    // arena block that the root node lives in
+    JobScheduler *search_scheduler;          // thread pool for parallel search (allocated on first use)
+    WorkStealingScheduler *rollout_scheduler;    // thread pool for pipelined search (allocated on first use)
+    JobScheduler *reclaimer;                 // one thread that frees discarded subtrees in order (allocated on first use)
+    unordered_map<unsigned long long, MCTS_node *> *transpositions;   // state hash -> node (NULL if not sharing nodes)
+    unsigned long transposition_lookups, transposition_hits;
+    MCTS_rng rng;                            // the search's random stream: every rollout gets a stream split off it
+    ostream *stats_log;                      // where every search's stats go as a JSON line (NULL for nowhere)
+    JobScheduler *ponderer;                  // one thread that grows the tree while it waits for the next move (allocated on first use)
+    atomic<bool> stop_search;                // tells a pondering search to stop at its next iteration
+    bool pondering;
+    int pondered_iterations;                 // of the last pondering search (written by the ponderer)
+    const MCTS_leaf_evaluator *evaluator;    // evaluates leaves instead of rollouts (NULL for rollouts, not owned)
+    unsigned int evaluation_batch;
+    double evaluation_latency;
+    bool quiet;                              // no progress output from the searches (which DEBUG builds print to cout)
+    static MCTS_node *select(MCTS_node *from, double c, search_mode mode);
+    int grow(int max_iter, MCTS_deadline deadline, unsigned int number_of_threads, search_mode mode);
+    MCTS_node *allocate_root(MCTS_state *state, unsigned int &block);
+    int grow_tree_parallel(int max_iter, const MCTS_deadline &deadline, unsigned int number_of_threads, search_mode mode);
+    bool prune();
+    void expand_shared(MCTS_node *node);
+    void keep_shared_nodes(MCTS_node *next);
+    void rebuild_transpositions();
+    friend class MCTS_time_manager;
 public:
-    MCTS_tree(MCTS_state *starting_state);
+    MCTS_tree(MCTS_state *starting_state, bool use_transpositions = false);
     ~MCTS_tree();
-    MCTS_node *select(double c=1.41);        // select child node to expand according to tree policy (UCT)
+    MCTS_node *select(double c=EXPLORATION_CONSTANT, search_mode mode=SERIAL_SEARCH);    // select child node to expand according to tree policy (UCT)
     MCTS_node *select_best_child();          // select the most promising child of the root node
-    void grow_tree(int max_iter, double max_time_in_seconds);
+    int grow_tree(int max_iter, double max_time_in_seconds, unsigned int number_of_threads = 1, search_mode mode = TREE_PARALLEL_SEARCH);
+    int grow_tree_pipelined(int max_iter, const MCTS_deadline &deadline, unsigned int number_of_threads);
+    int grow_tree_batched(int max_iter, const MCTS_deadline &deadline);
+    static void grow_tree_worker(MCTS_node *root, search_mode mode, int max_iter, MCTS_deadline deadline,
+                                 atomic<int> *iterations, MCTS_rng &rng);
     void advance_tree(const MCTS_move *move);      // if the move is applicable advance the tree, else start over
+    /** Pondering: keep growing the tree in the background (e.g. while the opponent thinks) until stopped. advance_tree(),
+     * grow_tree() and the destructor stop it first; (!) anything else must not be called before stop_pondering(). */
+    void start_pondering(int max_iter, unsigned int number_of_threads = 1, search_mode mode = TREE_PARALLEL_SEARCH);
+    int stop_pondering();                    // returns the number of iterations made while pondering (0 if not pondering)
+    bool is_pondering() const { return pondering; }
+    void ponder(int max_iter, unsigned int number_of_threads, search_mode mode);     // (run by the ponderer)
+    static void reclaim(MCTS_arena *arena, MCTS_garbage &garbage);
+    void seed(unsigned long long s) { rng = MCTS_rng(s); }    // (!) repeatable only for serial and root-parallel search
     unsigned int get_size() const;
+    proof_status get_proof() const { return root->get_proof(); }      // of the current state, if the search has solved it
+    unsigned long get_node_memory() const;   // bytes of node arena held by the tree (not counting states and moves)
+    unsigned long get_memory_usage() const { return arena->get_memory_usage(); }   // nodes in use plus their states, moves etc
+    void set_memory_budget(unsigned long bytes);   // prune the tree whenever it uses more (0 for none, not with transpositions)
+    void set_checkpoints(unsigned int interval, unsigned int visits = 0);   // which new nodes keep their state (not with transpositions)
+    void set_progressive_widening(double coefficient = WIDENING_COEFFICIENT, double exponent = WIDENING_EXPONENT);   // 0 to turn off
+    void set_rave(unsigned int equivalence = RAVE_EQUIVALENCE);   // 0 to turn off (not updated by pipelined search)
+    void set_leaf_evaluator(const MCTS_leaf_evaluator *e, unsigned int batch_size = EVALUATION_BATCH,
+                            double max_latency = EVALUATION_MAX_LATENCY);   // NULL for rollouts (not with transpositions)
+    void set_exploration(double c = EXPLORATION_CONSTANT) { arena->set_exploration(c); }    // c of UCT for the searches
+    void set_rollouts_per_leaf(unsigned int n);   // serial search: n rollouts of every leaf on its own thread (0 for the default)
+    MCTS_search_stats get_search_stats() const;    // of the search since the last advance_tree() or reset_search_stats()
+    void reset_search_stats();
+    void set_stats_log(ostream *out) { stats_log = out; }     // advance_tree() writes the stats of the search before it there
+    void set_quiet(bool q) { quiet = q; }    // no progress output on cout (e.g. when several trees search at once)
+    bool save_book(const string &path, unsigned int depth, unsigned int min_visits = 1, bool hashes = true) const;
+    unsigned int load_book(const MCTS_book &book, unsigned int depth = UINT_MAX);   // returns the number of nodes added
     const MCTS_state *get_current_state() const;
     void print_stats() const;
 };
 
 
+/** Splits a game clock between the moves of a game. A move gets a share of the remaining time (its budget) which the search
+ * cuts short once the most visited root move cannot be overtaken any more, or extends (up to TIME_MAX_EXTENSION times)
+ * while the root is unstable, i.e. the most visited move keeps changing or is not the one with the best win rate.
+ * How many moves are left and how much a move matters are up to the game (e.g. remaining walls in Quoridor). */
+class MCTS_time_manager {
+    double remaining, increment, max_move_time;
+public:
+    explicit MCTS_time_manager(double game_seconds, double increment_seconds = 0.0, double max_move_seconds = 1e9)
+        : remaining(game_seconds), increment(increment_seconds), max_move_time(max_move_seconds) {}
+    double budget(unsigned int expected_moves_left, double importance = 1.0) const;
+    double think(MCTS_tree *tree, int max_iter, unsigned int expected_moves_left, double importance = 1.0,
+                 unsigned int number_of_threads = 1, search_mode mode = TREE_PARALLEL_SEARCH);   // returns the seconds spent
+    double get_remaining_time() const { return remaining; }
+};
+
+
 class MCTS_agent {                           // example of an agent based on the MCTS_tree. One can also use the tree directly.
     MCTS_tree *tree;
-    int max_iter, max_seconds;
+    int max_iter;
+    double max_seconds;
+    unsigned int number_of_threads;
+    search_mode mode;
+    bool pondering;                          // search during the opponent's turn (see MCTS_tree::start_pondering)
 public:
-    MCTS_agent(MCTS_state *starting_state, int max_iter = 100000, int max_seconds = 30);
+    MCTS_agent(MCTS_state *starting_state, int max_iter = 100000, double max_seconds = 30, unsigned int number_of_threads = 1,
+               search_mode mode = TREE_PARALLEL_SEARCH, bool use_transpositions = false);
     ~MCTS_agent();
     const MCTS_move *genmove(const MCTS_move *enemy_move);
+    void seed(unsigned long long s) { tree->seed(s); }
+    void set_memory_budget(unsigned long bytes) { tree->set_memory_budget(bytes); }
+    void set_checkpoints(unsigned int interval, unsigned int visits = 0) { tree->set_checkpoints(interval, visits); }
+    void set_progressive_widening(double coefficient = WIDENING_COEFFICIENT, double exponent = WIDENING_EXPONENT) {
+        tree->set_progressive_widening(coefficient, exponent);
+    }
+    void set_rave(unsigned int equivalence = RAVE_EQUIVALENCE) { tree->set_rave(equivalence); }
+    void set_exploration(double c = EXPLORATION_CONSTANT) { tree->set_exploration(c); }
+    void set_rollouts_per_leaf(unsigned int n) { tree->set_rollouts_per_leaf(n); }
+    void set_leaf_evaluator(const MCTS_leaf_evaluator *e, unsigned int batch_size = EVALUATION_BATCH,
+                            double max_latency = EVALUATION_MAX_LATENCY) {
+        tree->set_leaf_evaluator(e, batch_size, max_latency);
+    }
+    void set_stats_log(ostream *out) { tree->set_stats_log(out); }
+    void set_quiet(bool q) { tree->set_quiet(q); }
+    unsigned int load_book(const MCTS_book &book, unsigned int depth = UINT_MAX) { return tree->load_book(book, depth); }
+    // ponder after every genmove(): (!) until the next genmove() or stop_pondering() the tree must not be used otherwise
+    void set_pondering(bool on) { pondering = on; if (!on) tree->stop_pondering(); }
+    int stop_pondering() { return tree->stop_pondering(); }
     const MCTS_state *get_current_state() const;
     void feedback() const { tree->print_stats(); }
 };
 
 
 class RolloutJob : public Job {             // class for performing parallel simulations using a thread pool
-    double *score;
     const MCTS_state *state;
+    MCTS_rng rng;                            // this rollout's own random stream
+public:
+    double score;                            // result (the WorkStealingScheduler doesn't delete its jobs so it can be kept here)
+    #ifdef SEARCH_STATS
+    unsigned long long ns;                   // how long it took
+    #endif
+    explicit RolloutJob(const MCTS_state *state = NULL) : Job(), state(state), score(-1.0) {}
+    void set_state(const MCTS_state *s, const MCTS_rng &r) { state = s; rng = r; }
+    void run() override {
+        #ifdef SEARCH_STATS
+        auto started = chrono::steady_clock::now();
+        #endif
+        score = state->rollout(rng);
+        #ifdef SEARCH_STATS
+        ns = (unsigned long long) chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count();
+        #endif
+    }
+};
+
+
+class RolloutBatchJob : public Job {        // several simulations from the same state as one job (see MCTS_state::rollout_batch)
+    const MCTS_state *state;
+    unsigned int n;
+    MCTS_rng *rngs;
+    double *results;                         // n results (owned by whoever scheduled the job)
+    vector<int> *played;                     // NULL or n lists for the moves of each simulation (RAVE)
+public:
+    RolloutBatchJob() : Job(), state(NULL), n(0), rngs(NULL), results(NULL), played(NULL) {}
+    void set_batch(const MCTS_state *s, unsigned int count, MCTS_rng *r, double *res, vector<int> *p = NULL) {
+        state = s; n = count; rngs = r; results = res; played = p;
+    }
+    void run() override {
+        state->rollout_batch(n, rngs, results, played);
+    }
+};
+
+
+class CompletionQueue {                     // where asynchronous rollouts report back to the tree's thread
+    vector<Job *> jobs;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+public:
+    CompletionQueue() {
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&not_empty, NULL);
+    }
+    ~CompletionQueue() {
+        pthread_mutex_destroy(&lock);
+        pthread_cond_destroy(&not_empty);
+    }
+    void push(Job *job) {
+        pthread_mutex_lock(&lock);
+        jobs.push_back(job);
+        pthread_cond_signal(&not_empty);
+        pthread_mutex_unlock(&lock);
+    }
+    template <class J>
+    void pop_all(vector<J *> &out, bool wait) {      // moves every completed job to out (waiting for one if asked to)
+        pthread_mutex_lock(&lock);
+        while (wait && jobs.empty()) {
+            pthread_cond_wait(&not_empty, &lock);
+        }
+        for (auto *job : jobs) {
+            out.push_back((J *) job);
+        }
+        jobs.clear();
+        pthread_mutex_unlock(&lock);
+    }
+};
+
+
+class AsyncRolloutJob : public RolloutJob {  // a rollout whose result is backpropagated later by the tree's thread
+    MCTS_node *leaf;
+    CompletionQueue *completed;
+public:
+    explicit AsyncRolloutJob(CompletionQueue *completed) : RolloutJob(), leaf(NULL), completed(completed) {}
+    void set_leaf(MCTS_node *node, const MCTS_rng &r) { leaf = node; set_state(node->get_current_state(), r); }
+    MCTS_node *get_leaf() const { return leaf; }
+    void run() override {
+        RolloutJob::run();
+        completed->push(this);     // (!) must be the last thing we do: the tree's thread reuses this job right after
+    }
+};
+
+
+class ReclaimJob : public Job {             // frees the subtrees discarded by advance_tree() off the search's critical path
+    MCTS_arena *arena;
+    MCTS_garbage garbage;
+public:
+    ReclaimJob(MCTS_arena *arena, MCTS_garbage &g) : Job(), arena(arena) { garbage.nodes.swap(g.nodes); garbage.blocks.swap(g.blocks); }
+    void run() override { MCTS_tree::reclaim(arena, garbage); }
+};
+
+
+class PonderJob : public Job {              // grows the tree until MCTS_tree::stop_pondering() (or max_iter iterations)
+    MCTS_tree *tree;
+    int max_iter;
+    unsigned int number_of_threads;
+    search_mode mode;
+public:
+    PonderJob(MCTS_tree *tree, int max_iter, unsigned int number_of_threads, search_mode mode)
+        : Job(), tree(tree), max_iter(max_iter), number_of_threads(number_of_threads), mode(mode) {}
+    void run() override { tree->ponder(max_iter, number_of_threads, mode); }
+};
+
+
+class GrowTreeJob : public Job {            // one of the threads of a tree-parallel or root-parallel search
+    MCTS_node *root;                         // the shared tree's root or this thread's own tree in root-parallel mode
+    search_mode mode;
+    int max_iter;
+    MCTS_deadline deadline;                  // (!) a copy per worker: polling it is not thread-safe
+    atomic<int> *iterations;                 // shared between all workers of the same tree
+    MCTS_rng rng;                            // this worker's random stream
 public:
-    RolloutJob(const MCTS_state *state, double *score) : Job(), state(state), score(score) {}
+    GrowTreeJob(MCTS_node *root, search_mode mode, int max_iter, const MCTS_deadline &deadline, atomic<int> *iterations, const MCTS_rng &rng)
+        : Job(), root(root), mode(mode), max_iter(max_iter), deadline(deadline), iterations(iterations), rng(rng) {}
     void run() override {
-        // put the result in the memory specified at construction time as this Job will be deleted when done (can't store it here)
-        *score = state->rollout();
+        MCTS_tree::grow_tree_worker(root, mode, max_iter, deadline, iterations, rng);
     }
 };
 
@@ -0,0 +1,232 @@
+#ifndef MCTS_STATIC_H
+#define MCTS_STATIC_H
+
+#include "mcts.h"
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <random>
+#include <type_traits>
+
+
+/** Header-only MCTS for a game known at compile time: MCTS_static_tree<State, Move> stores states and moves by value and
+ * calls the game's hooks directly (inlined if the game's classes are final or not polymorphic at all) instead of through
+ * the virtual interface of state.h. Serial search only: MCTS_tree remains the engine for parallel search, transpositions,
+ * memory budgets etc.
+ *
+ * A State must be copyable and provide (checked at compile time by MCTS_static_traits):
+ *   bool is_terminal() const;
+ *   bool player1_turn() const;
+ *   void legal_moves(vector<Move> &moves);      // appends the moves to try (may be const, or not to update caches)
+ *   void play(const Move &move);                // in place
+ *   double rollout(MCTS_rng &rng) const;        // in [0, 1], 1 for a P1 win
+ * A Move must be copyable and comparable with ==.
+ * Any MCTS_state can still be used through the MCTS_virtual_state / MCTS_virtual_move adapters at the end of this file. */
+
+
+template <class State, class Move>
+class MCTS_static_traits {
+    template <class S> static auto terminal(int) -> decltype((bool) declval<const S &>().is_terminal(), true_type());
+    template <class S> static false_type terminal(...);
+    template <class S> static auto turn(int) -> decltype((bool) declval<const S &>().player1_turn(), true_type());
+    template <class S> static false_type turn(...);
+    template <class S> static auto moves(int) -> decltype(declval<S &>().legal_moves(declval<vector<Move> &>()), true_type());
+    template <class S> static false_type moves(...);
+    template <class S> static auto play(int) -> decltype(declval<S &>().play(declval<const Move &>()), true_type());
+    template <class S> static false_type play(...);
+    template <class S> static auto rollout(int) -> decltype((double) declval<const S &>().rollout(declval<MCTS_rng &>()), true_type());
+    template <class S> static false_type rollout(...);
+    template <class M> static auto equal(int) -> decltype((bool) (declval<const M &>() == declval<const M &>()), true_type());
+    template <class M> static false_type equal(...);
+public:
+    static const bool has_is_terminal = decltype(terminal<State>(0))::value;
+    static const bool has_player1_turn = decltype(turn<State>(0))::value;
+    static const bool has_legal_moves = decltype(moves<State>(0))::value;
+    static const bool has_play = decltype(play<State>(0))::value;
+    static const bool has_rollout = decltype(rollout<State>(0))::value;
+    static const bool comparable_moves = decltype(equal<Move>(0))::value;
+};
+
+
+template <class State, class Move>
+class MCTS_static_tree {
+    typedef MCTS_static_traits<State, Move> traits;
+    static_assert(traits::has_is_terminal, "State needs bool is_terminal() const");
+    static_assert(traits::has_player1_turn, "State needs bool player1_turn() const");
+    static_assert(traits::has_legal_moves, "State needs void legal_moves(vector<Move> &)");
+    static_assert(traits::has_play, "State needs void play(const Move &)");
+    static_assert(traits::has_rollout, "State needs double rollout(MCTS_rng &) const");
+    static_assert(traits::comparable_moves, "Move needs operator==");
+    static_assert(is_copy_constructible<State>::value && is_copy_constructible<Move>::value, "States and moves are stored by value");
+
+    static const unsigned int NONE = (unsigned int) -1;
+    struct Node {
+        State state;
+        unsigned int parent;
+        vector<Move> moves;                  // legal moves (generated when first expanded): children[i] is after moves[i]
+        vector<unsigned int> children;       // so moves[children.size()] is the next untried one
+        bool expanded, terminal, player1;
+        unsigned int visits;
+        double score;
+        Node(const State &s, unsigned int parent)
+            : state(s), parent(parent), expanded(false), terminal(s.is_terminal()), player1(s.player1_turn()), visits(0), score(0.0) {}
+        bool fully_expanded() const { return terminal || (expanded && children.size() == moves.size()); }
+        double winrate(bool player1turn) const { return player1turn ? score / visits : 1.0 - score / visits; }
+    };
+    deque<Node> nodes;                       // by index: stable references while growing, nodes[0] is the root
+    MCTS_rng rng;
+    double exploration;                      // c of UCT (see set_exploration)
+
+    unsigned int select_best_child(unsigned int n, double c) const {
+        /** same UCT as MCTS_node::select_best_child() */
+        const Node &node = nodes[n];
+        unsigned int argmax = NONE;
+        double max = -1;
+        for (unsigned int child : node.children) {
+            const Node &ch = nodes[child];
+            double uct = ch.winrate(node.player1);
+            if (c > 0) uct += c * sqrt(log((double) node.visits) / ch.visits);
+            if (uct > max) {
+                max = uct;
+                argmax = child;
+            }
+        }
+        return argmax;
+    }
+
+    unsigned int select() const {
+        unsigned int n = 0;
+        while (!nodes[n].terminal && nodes[n].fully_expanded()) {
+            unsigned int best = select_best_child(n, exploration);
+            if (best == NONE) break;         // no legal moves in a non-terminal state
+            n = best;
+        }
+        return n;
+    }
+
+    unsigned int expand(unsigned int n) {
+        /** Returns the new child or n itself if it cannot be expanded (e.g. terminal: roll it out again) */
+        Node &node = nodes[n];
+        if (node.terminal) return n;
+        if (!node.expanded) {
+            node.state.legal_moves(node.moves);
+            node.expanded = true;
+        }
+        if (node.children.size() >= node.moves.size()) {
+            cerr << "Warning: Cannot expanded this node any more!" << endl;
+            return n;
+        }
+        State next(node.state);
+        next.play(node.moves[node.children.size()]);
+        node.children.push_back((unsigned int) nodes.size());
+        nodes.push_back(Node(next, n));      // (!) references into a deque survive push_back
+        return node.children.back();
+    }
+
+    void backpropagate(unsigned int n, double w) {
+        for ( ; n != NONE ; n = nodes[n].parent) {
+            nodes[n].visits++;
+            nodes[n].score += w;
+        }
+    }
+
+public:
+    explicit MCTS_static_tree(const State &starting_state)
+        : rng(random_device()() ^ ((unsigned long long) time(NULL) << 32)), exploration(EXPLORATION_CONSTANT) {
+        nodes.push_back(Node(starting_state, NONE));
+    }
+
+    void seed(unsigned long long s) { rng = MCTS_rng(s); }
+    void set_exploration(double c = EXPLORATION_CONSTANT) { exploration = c; }    // as MCTS_tree::set_exploration
+
+    int grow_tree(int max_iter, double max_time_in_seconds) {
+        /** Returns the number of iterations made */
+        MCTS_deadline deadline(max_time_in_seconds);
+        int i = 0;
+        while (i < max_iter) {
+            unsigned int leaf = expand(select());
+            MCTS_rng rollout_rng = rng.split();
+            backpropagate(leaf, nodes[leaf].state.rollout(rollout_rng));
+            i++;
+            if (deadline.poll()) break;
+        }
+        return i;
+    }
+
+    const Move *select_best_move() const {
+        /** NULL if the root has no children yet */
+        unsigned int best = select_best_child(0, 0.0);
+        if (best == NONE) return NULL;
+        const Node &root = nodes[0];
+        for (unsigned int i = 0 ; i < root.children.size() ; i++) {
+            if (root.children[i] == best) return &root.moves[i];
+        }
+        return NULL;
+    }
+
+    void advance_tree(const Move &move) {
+        /** Keeps the subtree of move (or starts over if it has not been tried) */
+        const Node &root = nodes[0];
+        unsigned int next = NONE;
+        for (unsigned int i = 0 ; i < root.children.size() ; i++) {
+            if (root.moves[i] == move) {
+                next = root.children[i];
+                break;
+            }
+        }
+        deque<Node> kept;
+        if (next == NONE) {
+            State s(root.state);
+            s.play(move);
+            kept.push_back(Node(s, NONE));
+        } else {
+            // copy the subtree breadth-first, renumbering its nodes
+            kept.push_back(std::move(nodes[next]));
+            kept[0].parent = NONE;
+            for (unsigned int i = 0 ; i < kept.size() ; i++) {
+                for (unsigned int &child : kept[i].children) {
+                    kept.push_back(std::move(nodes[child]));
+                    kept.back().parent = i;
+                    child = (unsigned int) kept.size() - 1;
+                }
+            }
+        }
+        nodes.swap(kept);
+    }
+
+    const State &get_current_state() const { return nodes[0].state; }
+    unsigned int get_size() const { return (unsigned int) nodes.size(); }
+    unsigned int get_number_of_simulations() const { return nodes[0].visits; }
+};
+
+
+/** Adapters: any MCTS_state / MCTS_move behind the static interface (with one virtual call per hook, as in MCTS_tree) */
+class MCTS_virtual_move {
+    shared_ptr<const MCTS_move> move;        // (!) shared: moves are copied around by value
+public:
+    explicit MCTS_virtual_move(const MCTS_move *move) : move(move) {}
+    const MCTS_move *get() const { return move.get(); }
+    bool operator==(const MCTS_virtual_move &other) const { return *move == *other.move; }
+};
+
+
+class MCTS_virtual_state {
+    shared_ptr<const MCTS_state> state;      // never changed in place so copies can share it
+public:
+    explicit MCTS_virtual_state(const MCTS_state *state) : state(state) {}
+    const MCTS_state *get() const { return state.get(); }
+    bool is_terminal() const { return state->is_terminal(); }
+    bool player1_turn() const { return state->player1_turn(); }
+    void legal_moves(vector<MCTS_virtual_move> &moves) const {
+        MCTS_move_generator *generator = state->actions_generator();
+        for (MCTS_move *m = generator->next() ; m != NULL ; m = generator->next()) {
+            moves.push_back(MCTS_virtual_move(m));
+        }
+        delete generator;
+    }
+    void play(const MCTS_virtual_move &move) { state.reset(state->next_state(move.get())); }
+    double rollout(MCTS_rng &rng) const { return state->rollout(rng); }
+};
+
+
+#endif
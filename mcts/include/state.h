@@ -3,6 +3,8 @@
 
 #include <stdexcept>
 #include <queue>
+#include <vector>
+#include <algorithm>
 
 
 using namespace std;
@@ -12,12 +14,85 @@ struct MCTS_move {
     virtual ~MCTS_move() = default;
     virtual bool operator==(const MCTS_move& other) const = 0;             // implement this!
     virtual string sprint() const { return "Not implemented"; }   // and optionally this
+    virtual unsigned long memory_usage() const { return 0; }       // bytes of this move (for MCTS_tree's memory budget)
+    virtual int id() const { return -1; }    // small and unique per move and player, for RAVE (-1 = none, see MCTS_tree::set_rave)
+};
+
+
+/** Yields the moves of a state one at a time so that they are only generated if and when they are needed */
+class MCTS_move_generator {
+public:
+    virtual ~MCTS_move_generator() = default;
+    virtual MCTS_move *next() = 0;                     // returns NULL when there are no more moves
+    virtual unsigned int max_number_of_moves() const = 0;  // upper bound for the total number of moves (including those already returned)
+    virtual unsigned long memory_usage() const { return 0; }   // bytes of the generator and the moves it still holds
+};
+
+
+class MCTS_queue_move_generator : public MCTS_move_generator {    // default generator: all moves are generated upfront
+    queue<MCTS_move *> *moves;
+    unsigned int total;
+    unsigned long bytes;                               // of the moves still in the queue
+public:
+    explicit MCTS_queue_move_generator(queue<MCTS_move *> *moves) : moves(moves), total((unsigned int) moves->size()), bytes(0) {
+        for (unsigned int i = 0 ; i < total ; i++) {   // (a queue can't be iterated)
+            bytes += moves->front()->memory_usage();
+            moves->push(moves->front());
+            moves->pop();
+        }
+    }
+    ~MCTS_queue_move_generator() override {
+        while (!moves->empty()) {
+            delete moves->front();
+            moves->pop();
+        }
+        delete moves;
+    }
+    MCTS_move *next() override {
+        if (moves->empty()) return NULL;
+        MCTS_move *m = moves->front();
+        moves->pop();
+        bytes -= m->memory_usage();
+        return m;
+    }
+    unsigned int max_number_of_moves() const override { return total; }
+    unsigned long memory_usage() const override {
+        return sizeof(*this) + sizeof(*moves) + moves->size() * sizeof(MCTS_move *) + bytes;
+    }
+};
+
+
+/** Random number stream handed to every rollout (SplitMix64: tiny, fast and every seed gives a good stream).
+ * It is a UniformRandomBitGenerator so it works with <random>'s distributions and shuffle().
+ * The search gives each rollout its own stream derived from the tree's seed (see MCTS_tree::seed) so that threads never
+ * share a generator and a search can be repeated exactly. */
+class MCTS_rng {
+    unsigned long long x;
+public:
+    typedef unsigned long long result_type;
+    explicit MCTS_rng(unsigned long long seed = 0) : x(seed) {}
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return ~0ULL; }
+    result_type operator()() {
+        unsigned long long z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    MCTS_rng split() { return MCTS_rng((*this)()); }     // an independent stream for someone else
 };
 
 
 /** Implement all pure virtual methods. Notes:
  * - rollout() must return something in [0, 1] for UCT to work as intended and specifically
  * the winning chance of player1.
+ * - rollout() should draw all of its randomness from rng (it may run on any thread, concurrently with other rollouts)
+ * - rollout() of a terminal state must return its exact result (1, 0 or 0.5 for a draw) so that the solver can prove it
+ * (see MCTS-Solver in mcts.h)
+ * - rollout_with_moves() must return what rollout() would with the same stream
+ * - rollout_batch() runs n rollouts at once, the i-th with its own stream rngs[i] (and its moves in played[i] unless played
+ * is NULL). Override it if they can share setup work and scratch memory but keep results[i] equal to what rollout(rngs[i])
+ * would return.
  * - player1 is determined by player1_turn()
  */
 class MCTS_state {
@@ -26,12 +101,82 @@ public:
     virtual ~MCTS_state() = default;
     virtual queue<MCTS_move *> *actions_to_try() const = 0;
     virtual MCTS_state *next_state(const MCTS_move *move) const = 0;
-    virtual double rollout() const = 0;
+    virtual double rollout(MCTS_rng &rng) const = 0;
     virtual bool is_terminal() const = 0;
     virtual void print() const {
         cout << "Printing not implemented" << endl;
     }
     virtual bool player1_turn() const = 0;     // MCTS is for two-player games mostly -> (keeps win rate)
+    // Optionally implement these:
+    virtual MCTS_state *clone() const { return NULL; }            // needed for root-parallel search
+    virtual MCTS_move_generator *actions_generator() const {      // incremental version of actions_to_try()
+        return new MCTS_queue_move_generator(actions_to_try());
+    }
+    virtual unsigned long long hash() const { return 0; }        // for transpositions (0 = never share this state)
+    virtual unsigned long memory_usage() const { return 0; }     // bytes of this state (for MCTS_tree's memory budget)
+    virtual void rollout_batch(unsigned int n, MCTS_rng *rngs, double *results, vector<int> *played) const {
+        for (unsigned int i = 0 ; i < n ; i++) {
+            results[i] = (played != NULL) ? rollout_with_moves(rngs[i], played[i]) : rollout(rngs[i]);
+        }
+    }
+    virtual double rollout_with_moves(MCTS_rng &rng, vector<int> &) const {   // rollout() that appends the ids of
+        return rollout(rng);                                                 // the moves it plays (for RAVE)
+    }
+    virtual void action_priorities(const vector<MCTS_move *> &, vector<double> &) const {}
+                                               // priorities[i] (initially 0) of actions[i]: higher ones get expanded first
+};
+
+
+/** Evaluates leaves in batches instead of rolling them out (see MCTS_tree::set_leaf_evaluator). Notes:
+ * - values[i] must be player 1's winning chance in states[i], in [0, 1] like a rollout's result
+ * - only non-terminal states are evaluated: terminal ones are rolled out (their result is exact, see MCTS-Solver)
+ * - evaluate() may be called by several trees at once
+ */
+class MCTS_leaf_evaluator {
+public:
+    virtual ~MCTS_leaf_evaluator() = default;
+    virtual void evaluate(const MCTS_state * const *states, unsigned int n, double *values) const = 0;
+};
+
+
+class MCTS_priority_move_generator : public MCTS_move_generator {
+    /** Yields the actions of a state best first as ranked by MCTS_state::action_priorities() (ties in generation order).
+     * All of them are generated and ranked up front. Used for progressive widening (see MCTS_tree::set_progressive_widening). */
+    vector<MCTS_move *> moves;                         // worst first so that next() takes them from the back
+    unsigned int total;
+    unsigned long bytes;                               // of the moves not taken yet
+public:
+    explicit MCTS_priority_move_generator(const MCTS_state *state) : total(0), bytes(0) {
+        MCTS_move_generator *generator = state->actions_generator();
+        for (MCTS_move *m = generator->next() ; m != NULL ; m = generator->next()) {
+            moves.push_back(m);
+            bytes += m->memory_usage();
+        }
+        delete generator;
+        total = (unsigned int) moves.size();
+        vector<double> priorities(moves.size(), 0.0);
+        state->action_priorities(moves, priorities);
+        vector<unsigned int> order(moves.size());
+        for (unsigned int i = 0 ; i < order.size() ; i++) order[i] = i;
+        stable_sort(order.begin(), order.end(), [&priorities](unsigned int a, unsigned int b) { return priorities[a] > priorities[b]; });
+        vector<MCTS_move *> sorted(moves.size());
+        for (unsigned int i = 0 ; i < order.size() ; i++) sorted[order.size() - 1 - i] = moves[order[i]];
+        moves.swap(sorted);
+    }
+    ~MCTS_priority_move_generator() override {
+        for (MCTS_move *m : moves) delete m;
+    }
+    MCTS_move *next() override {
+        if (moves.empty()) return NULL;
+        MCTS_move *m = moves.back();
+        moves.pop_back();
+        bytes -= m->memory_usage();
+        return m;
+    }
+    unsigned int max_number_of_moves() const override { return total; }     // (exact: all moves are known)
+    unsigned long memory_usage() const override {
+        return sizeof(*this) + moves.capacity() * sizeof(MCTS_move *) + bytes;
+    }
 };
 
 
@@ -3,16 +3,20 @@
 
 #define CHECK_PERROR(call, msg, actions) { if ( (call) < 0 ) { perror(msg); actions } }
 
+static unsigned long long ns_since(chrono::steady_clock::time_point t) {
+    return (unsigned long long) chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t).count();
+}
+
 using namespace std;
 
 
 /* JobScheduler Implementation */
-JobScheduler::JobScheduler(unsigned int _number_of_threads) : jobs_running(0), number_of_threads(_number_of_threads), t_args(NULL) {
+JobScheduler::JobScheduler(unsigned int _number_of_threads) : jobs_running(0), number_of_threads(_number_of_threads), t_args(NULL), collect_stats(false) {
     threads_must_exit = false;
     CHECK_PERROR(pthread_mutex_init(&queue_lock, NULL), "pthread_mutex_t_init failed",)
     CHECK_PERROR(pthread_cond_init(&queue_cond, NULL), "pthread_cond_init failed",)
     CHECK_PERROR(pthread_cond_init(&jobs_finished_cond, NULL), "pthread_cond_init failed",)
-    t_args = new struct thread_args(&job_queue, &queue_lock, &queue_cond, &jobs_running, &threads_must_exit, &jobs_finished_cond, &tagged_jobs_pending);
+    t_args = new struct thread_args(&job_queue, &queue_lock, &queue_cond, &jobs_running, &threads_must_exit, &jobs_finished_cond, &tagged_jobs_pending, &stats, &collect_stats);
     threads = new pthread_t[number_of_threads];
     for (int i = 0; i < number_of_threads; i++) {
         CHECK_PERROR(pthread_create(&threads[i], NULL, thread_code, (void *) t_args), "pthread_create failed", threads[i] = 0;)
@@ -21,12 +25,12 @@ JobScheduler::JobScheduler(unsigned int _number_of_threads) : jobs_running(0), n
 
 JobScheduler::~JobScheduler() {
     waitUntilJobsHaveFinished();     // (!) important
-    delete t_args;
     threads_must_exit = true;
     CHECK_PERROR(pthread_cond_broadcast(&queue_cond), "pthread_broadcast failed", )
     for (int i = 0; i < number_of_threads; i++) {
         CHECK_PERROR(pthread_join(threads[i], NULL), "pthread_join failed", )
     }
+    delete t_args;                   // (!) only now: a thread that has just started may not have read it yet
     delete[] threads;
     CHECK_PERROR(pthread_mutex_destroy(&queue_lock), "pthread_mutex_destroy failed", )
     CHECK_PERROR(pthread_cond_destroy(&queue_cond), "pthread_cond_destroy failed", )
@@ -35,6 +39,11 @@ JobScheduler::~JobScheduler() {
 
 void JobScheduler::schedule(Job *job) {
     CHECK_PERROR(pthread_mutex_lock(&queue_lock), "pthread_mutex_lock failed", )
+    chrono::steady_clock::time_point locked_at;
+    if (collect_stats) {
+        locked_at = chrono::steady_clock::now();
+        job->scheduled_at = locked_at;
+    }
     if (job->TAG != NOTAG){
         auto it = tagged_jobs_pending.find(job->TAG);
         if (it == tagged_jobs_pending.end()) tagged_jobs_pending.insert(make_pair(job->TAG, 1));
@@ -42,6 +51,29 @@ void JobScheduler::schedule(Job *job) {
     }
     job_queue.push(job);
     CHECK_PERROR(pthread_cond_signal(&queue_cond), "pthread_cond_signal failed", )
+    if (collect_stats) {
+        stats.lock_acquisitions++;
+        stats.lock_hold_ns += ns_since(locked_at);
+    }
+    CHECK_PERROR(pthread_mutex_unlock(&queue_lock), "pthread_mutex_unlock failed", )
+}
+
+void JobScheduler::set_stats(bool on) {
+    CHECK_PERROR(pthread_mutex_lock(&queue_lock), "pthread_mutex_lock failed", )
+    collect_stats = on;
+    CHECK_PERROR(pthread_mutex_unlock(&queue_lock), "pthread_mutex_unlock failed", )
+}
+
+SchedulerStats JobScheduler::get_stats() {
+    CHECK_PERROR(pthread_mutex_lock(&queue_lock), "pthread_mutex_lock failed", )
+    SchedulerStats result = stats;
+    CHECK_PERROR(pthread_mutex_unlock(&queue_lock), "pthread_mutex_unlock failed", )
+    return result;
+}
+
+void JobScheduler::reset_stats() {
+    CHECK_PERROR(pthread_mutex_lock(&queue_lock), "pthread_mutex_lock failed", )
+    stats = SchedulerStats();
     CHECK_PERROR(pthread_mutex_unlock(&queue_lock), "pthread_mutex_unlock failed", )
 }
 
@@ -94,6 +126,8 @@ void *thread_code(void *args) {
     volatile bool *threads_must_exit_ptr = argptr->threads_must_exit;
     pthread_cond_t *jobs_finished_cond_ptr = argptr->jobs_finished_cond;
     unordered_map<int, volatile unsigned int> *tagged_jobs_pending_ptr = argptr->tagged_jobs_pending;
+    SchedulerStats *stats = argptr->stats;
+    bool *collect_stats_ptr = argptr->collect_stats;
 
     while (!(*threads_must_exit_ptr)) {
         Job *job;
@@ -107,9 +141,17 @@ void *thread_code(void *args) {
             CHECK_PERROR(pthread_mutex_unlock(queue_lock), "pthread_mutex_unlock failed", )
             break;
         }
+        chrono::steady_clock::time_point locked_at;
+        if (*collect_stats_ptr) locked_at = chrono::steady_clock::now();      // (the lock was released while waiting for a job)
         job = job_queue->front();       // get pointer to next job
         job_queue->pop();               // remove it from queue
         (*jobs_running_ptr)++;
+        if (*collect_stats_ptr) {
+            stats->jobs++;
+            stats->queue_wait_ns += ns_since(job->scheduled_at);
+            stats->lock_acquisitions++;
+            stats->lock_hold_ns += ns_since(locked_at);
+        }
         CHECK_PERROR(pthread_mutex_unlock(queue_lock), "pthread_mutex_unlock failed", )
 
         tag = job->TAG;
@@ -117,14 +159,19 @@ void *thread_code(void *args) {
         delete job;                     // (!) scheduler deletes scheduled objects when done but they must be allocated before they get scheduled
 
         CHECK_PERROR(pthread_mutex_lock(queue_lock), "pthread_mutex_lock failed", )
+        if (*collect_stats_ptr) locked_at = chrono::steady_clock::now();
         int num = 0;
-        if (job->TAG != NOTAG){
-            num = --(*tagged_jobs_pending_ptr)[job->TAG];
+        if (tag != NOTAG){               // (!) not job->TAG: job has been deleted
+            num = --(*tagged_jobs_pending_ptr)[tag];
         }
         (*jobs_running_ptr)--;
         if ( num == 0 || (*jobs_running_ptr) == 0 ){
             CHECK_PERROR(pthread_cond_broadcast(jobs_finished_cond_ptr), "pthread_cond_signal failed", )
         }
+        if (*collect_stats_ptr) {
+            stats->lock_acquisitions++;
+            stats->lock_hold_ns += ns_since(locked_at);
+        }
         CHECK_PERROR(pthread_mutex_unlock(queue_lock), "pthread_mutex_unlock failed", )
     }
     pthread_exit((void *) 0);
@@ -0,0 +1,210 @@
+#include <iostream>
+#include <sched.h>
+#include "../include/WorkStealingScheduler.h"
+
+#define CHECK_PERROR(call, msg, actions) { if ( (call) < 0 ) { perror(msg); actions } }
+
+using namespace std;
+
+
+/* WorkerQueue Implementation */
+unsigned int WorkerQueue::push(Job *const *batch, unsigned int n) {
+    while (push_lock.test_and_set(memory_order_acquire)) ;
+    unsigned long b = bottom.load(memory_order_relaxed);
+    unsigned long t = top.load(memory_order_acquire);
+    unsigned long room = WORKER_QUEUE_CAPACITY - (b - t);
+    unsigned int k = (n < room) ? n : (unsigned int) room;
+    for (unsigned int i = 0 ; i < k ; i++) {
+        jobs[(b + i) & (WORKER_QUEUE_CAPACITY - 1)].store(batch[i], memory_order_relaxed);
+    }
+    bottom.store(b + k, memory_order_seq_cst);     // (!) seq_cst: must not be reordered with the check for sleepers
+    push_lock.clear(memory_order_release);
+    return k;
+}
+
+Job *WorkerQueue::take() {
+    unsigned long t = top.load(memory_order_acquire);
+    while (true) {
+        unsigned long b = bottom.load(memory_order_acquire);
+        if (t >= b) return NULL;
+        // Note: the slot cannot be overwritten before top moves past it so this is valid if the CAS succeeds
+        Job *job = jobs[t & (WORKER_QUEUE_CAPACITY - 1)].load(memory_order_relaxed);
+        if (top.compare_exchange_weak(t, t + 1, memory_order_acq_rel, memory_order_acquire)) {
+            return job;
+        }
+    }
+}
+
+
+/* WorkStealingScheduler Implementation */
+WorkStealingScheduler::WorkStealingScheduler(unsigned int _number_of_threads)
+        : number_of_threads(_number_of_threads), threads_must_exit(false), next_queue(0), sleepers(0), jobs_pending(0) {
+    CHECK_PERROR(pthread_mutex_init(&sleep_lock, NULL), "pthread_mutex_t_init failed",)
+    CHECK_PERROR(pthread_cond_init(&work_cond, NULL), "pthread_cond_init failed",)
+    CHECK_PERROR(pthread_mutex_init(&jobs_lock, NULL), "pthread_mutex_t_init failed",)
+    CHECK_PERROR(pthread_cond_init(&jobs_finished_cond, NULL), "pthread_cond_init failed",)
+    queues = new WorkerQueue[number_of_threads];
+    w_args = new worker_args[number_of_threads];
+    threads = new pthread_t[number_of_threads];
+    for (unsigned int i = 0 ; i < number_of_threads ; i++) {
+        w_args[i].scheduler = this;
+        w_args[i].id = i;
+        CHECK_PERROR(pthread_create(&threads[i], NULL, thread_code, (void *) &w_args[i]), "pthread_create failed", threads[i] = 0;)
+    }
+}
+
+WorkStealingScheduler::~WorkStealingScheduler() {
+    waitUntilJobsHaveFinished();     // (!) important
+    CHECK_PERROR(pthread_mutex_lock(&sleep_lock), "pthread_mutex_lock failed", )
+    threads_must_exit = true;
+    CHECK_PERROR(pthread_cond_broadcast(&work_cond), "pthread_broadcast failed", )
+    CHECK_PERROR(pthread_mutex_unlock(&sleep_lock), "pthread_mutex_unlock failed", )
+    for (unsigned int i = 0 ; i < number_of_threads ; i++) {
+        CHECK_PERROR(pthread_join(threads[i], NULL), "pthread_join failed", )
+    }
+    delete[] threads;
+    delete[] w_args;
+    delete[] queues;
+    CHECK_PERROR(pthread_mutex_destroy(&sleep_lock), "pthread_mutex_destroy failed", )
+    CHECK_PERROR(pthread_cond_destroy(&work_cond), "pthread_cond_destroy failed", )
+    CHECK_PERROR(pthread_mutex_destroy(&jobs_lock), "pthread_mutex_destroy failed", )
+    CHECK_PERROR(pthread_cond_destroy(&jobs_finished_cond), "pthread_cond_destroy failed", )
+}
+
+void WorkStealingScheduler::schedule(Job *job) {
+    schedule_batch(&job, 1);
+}
+
+void WorkStealingScheduler::schedule_batch(Job *const *jobs, unsigned int n) {
+    if (n == 0) return;
+    // count jobs before anyone can run (and finish) them
+    bool tagged = false;
+    for (unsigned int i = 0 ; i < n && !tagged ; i++) {
+        tagged = jobs[i]->TAG != NOTAG;
+    }
+    if (tagged) {
+        CHECK_PERROR(pthread_mutex_lock(&jobs_lock), "pthread_mutex_lock failed", )
+        for (unsigned int i = 0 ; i < n ; i++) {
+            if (jobs[i]->TAG != NOTAG) tagged_jobs_pending[jobs[i]->TAG]++;
+        }
+        CHECK_PERROR(pthread_mutex_unlock(&jobs_lock), "pthread_mutex_unlock failed", )
+    }
+    jobs_pending += n;
+    // spread the batch evenly over the worker queues
+    unsigned int per_queue = (n + number_of_threads - 1) / number_of_threads;
+    unsigned int q = next_queue.fetch_add(1, memory_order_relaxed) % number_of_threads;
+    unsigned int done = 0, full = 0;
+    while (done < n) {
+        unsigned int k = (n - done < per_queue) ? n - done : per_queue;
+        unsigned int pushed = queues[q].push(jobs + done, k);
+        done += pushed;
+        full = (pushed == 0) ? full + 1 : 0;
+        if (full >= number_of_threads) {     // every queue is full: let the workers catch up
+            sched_yield();
+            full = 0;
+        }
+        q = (q + 1) % number_of_threads;
+    }
+    // wake up sleeping workers (if any)
+    if (sleepers.load(memory_order_seq_cst) > 0) {
+        CHECK_PERROR(pthread_mutex_lock(&sleep_lock), "pthread_mutex_lock failed", )
+        CHECK_PERROR(pthread_cond_broadcast(&work_cond), "pthread_cond_broadcast failed", )
+        CHECK_PERROR(pthread_mutex_unlock(&sleep_lock), "pthread_mutex_unlock failed", )
+    }
+}
+
+bool WorkStealingScheduler::JobsHaveFinished(int tag) {
+    if (tag == NOTAG) {
+        return jobs_pending.load() == 0;
+    }
+    bool result;
+    CHECK_PERROR(pthread_mutex_lock(&jobs_lock), "pthread_mutex_lock failed", )
+    auto it = tagged_jobs_pending.find(tag);
+    result = (it == tagged_jobs_pending.end()) || it->second == 0;
+    CHECK_PERROR(pthread_mutex_unlock(&jobs_lock), "pthread_mutex_unlock failed", )
+    return result;
+}
+
+void WorkStealingScheduler::waitUntilJobsHaveFinished(int tag) {
+    // spin for a bit first as jobs are typically short
+    for (int i = 0 ; i < SPINS_BEFORE_SLEEPING ; i++) {
+        if (tag == NOTAG && jobs_pending.load() == 0) return;
+    }
+    CHECK_PERROR(pthread_mutex_lock(&jobs_lock), "pthread_mutex_lock failed", )
+    if (tag == NOTAG) {
+        while (jobs_pending.load() > 0) {
+            CHECK_PERROR(pthread_cond_wait(&jobs_finished_cond, &jobs_lock), "pthread_cond_wait failed", )
+        }
+    } else {
+        auto it = tagged_jobs_pending.find(tag);
+        if (it != tagged_jobs_pending.end()) {
+            while (it->second > 0) {
+                CHECK_PERROR(pthread_cond_wait(&jobs_finished_cond, &jobs_lock), "pthread_cond_wait failed", )
+            }
+        }
+    }
+    CHECK_PERROR(pthread_mutex_unlock(&jobs_lock), "pthread_mutex_unlock failed", )
+}
+
+void WorkStealingScheduler::job_finished(int tag) {
+    bool notify = false;
+    if (tag != NOTAG) {
+        CHECK_PERROR(pthread_mutex_lock(&jobs_lock), "pthread_mutex_lock failed", )
+        notify = --tagged_jobs_pending[tag] == 0;
+        CHECK_PERROR(pthread_mutex_unlock(&jobs_lock), "pthread_mutex_unlock failed", )
+    }
+    if (jobs_pending.fetch_sub(1) == 1 || notify) {
+        // (!) take the lock so that a waiter can't miss this between checking and waiting
+        CHECK_PERROR(pthread_mutex_lock(&jobs_lock), "pthread_mutex_lock failed", )
+        CHECK_PERROR(pthread_cond_broadcast(&jobs_finished_cond), "pthread_cond_broadcast failed", )
+        CHECK_PERROR(pthread_mutex_unlock(&jobs_lock), "pthread_mutex_unlock failed", )
+    }
+}
+
+Job *WorkStealingScheduler::find_job(unsigned int id) {
+    // own queue first, then try to steal from the others
+    for (unsigned int i = 0 ; i < number_of_threads ; i++) {
+        Job *job = queues[(id + i) % number_of_threads].take();
+        if (job != NULL) return job;
+    }
+    return NULL;
+}
+
+
+/* Thread logic */
+void *WorkStealingScheduler::thread_code(void *args) {
+    struct worker_args *argptr = (struct worker_args *) args;
+    argptr->scheduler->worker_loop(argptr->id);
+    pthread_exit((void *) 0);
+}
+
+void WorkStealingScheduler::worker_loop(unsigned int id) {
+    int idle = 0;
+    while (!threads_must_exit) {
+        Job *job = find_job(id);
+        if (job != NULL) {
+            idle = 0;
+            int tag = job->TAG;         // (!) read before running: the job's owner may destroy it as soon as it's counted as finished
+            job->run();
+            job_finished(tag);
+            continue;
+        }
+        if (++idle < SPINS_BEFORE_SLEEPING) {
+            if (idle % 64 == 0) sched_yield();
+            continue;
+        }
+        // nothing to do for a while: sleep until new jobs get scheduled
+        CHECK_PERROR(pthread_mutex_lock(&sleep_lock), "pthread_mutex_lock failed", continue; )
+        sleepers.fetch_add(1, memory_order_seq_cst);
+        bool found = false;
+        for (unsigned int i = 0 ; i < number_of_threads && !found ; i++) {
+            found = !queues[i].empty();      // re-check after announcing that we sleep (see schedule_batch)
+        }
+        if (!found && !threads_must_exit) {
+            CHECK_PERROR(pthread_cond_wait(&work_cond, &sleep_lock), "pthread_cond_wait failed", )
+        }
+        sleepers.fetch_sub(1, memory_order_seq_cst);
+        CHECK_PERROR(pthread_mutex_unlock(&sleep_lock), "pthread_mutex_unlock failed", )
+        idle = 0;
+    }
+}
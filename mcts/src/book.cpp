@@ -0,0 +1,85 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/book.h"
+
+#define BOOK_MAGIC "MCTSBOOK"
+
+using namespace std;
+
+
+/* MCTS_book Implementation */
+bool MCTS_book::open(const string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Warning: Cannot open opening book " << path << endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(MCTS_book_header)) {
+        cerr << "Warning: " << path << " is not an opening book (too short)" << endl;
+        ::close(fd);
+        return false;
+    }
+    length = (size_t) st.st_size;
+    data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);                     // (the mapping keeps the file)
+    if (data == MAP_FAILED) {
+        perror("mmap failed");
+        data = NULL;
+        length = 0;
+        return false;
+    }
+    header = (const MCTS_book_header *) data;
+    const MCTS_book_record *r = (const MCTS_book_record *) (header + 1);
+    uint64_t n = header->number_of_records;
+    const char *problem = NULL;
+    if (memcmp(header->magic, BOOK_MAGIC, sizeof(header->magic)) != 0) problem = "not an opening book";
+    else if (header->version != BOOK_VERSION) problem = "of another version (or byte order)";
+    else if (n == 0 || n != (length - sizeof(MCTS_book_header)) / sizeof(MCTS_book_record)
+             || length != sizeof(MCTS_book_header) + n * sizeof(MCTS_book_record)) problem = "truncated";
+    // children must come after their parent and stay within the file so that reading the book can never go astray
+    for (uint64_t i = 0 ; problem == NULL && i < n ; i++) {
+        if (r[i].visits == 0 || (r[i].number_of_children > 0 && (r[i].first_child <= i || r[i].first_child > n
+                                                                  || r[i].number_of_children > n - r[i].first_child))) {
+            problem = "corrupt";
+        }
+    }
+    if (problem != NULL) {
+        cerr << "Warning: " << path << " is " << problem << endl;
+        close();
+        return false;
+    }
+    records = r;
+    return true;
+}
+
+void MCTS_book::close() {
+    if (data != NULL) munmap(data, length);
+    data = NULL;
+    length = 0;
+    header = NULL;
+    records = NULL;
+}
+
+bool MCTS_book::write(const string &path, const vector<MCTS_book_record> &records, bool hashes) {
+    MCTS_book_header header;
+    memcpy(header.magic, BOOK_MAGIC, sizeof(header.magic));
+    header.version = BOOK_VERSION;
+    header.flags = hashes ? BOOK_HASHES : 0;
+    header.number_of_records = records.size();
+    ofstream out(path.c_str(), ios::binary | ios::trunc);
+    out.write((const char *) &header, sizeof(header));
+    out.write((const char *) records.data(), records.size() * sizeof(MCTS_book_record));
+    out.close();
+    if (!out) {
+        cerr << "Warning: Could not write opening book " << path << endl;
+        return false;
+    }
+    return true;
+}
@@ -1,8 +1,15 @@
 #include <iostream>
 #include <cassert>
 #include <cmath>
+#include <climits>
 #include <ctime>
 #include <algorithm>
+#include <unordered_set>
+#include <functional>
+#include <random>
+#include <thread>
+#include <sstream>
+#include <iomanip>
 #include "../include/mcts.h"
 
 #define DEBUG
@@ -11,86 +18,764 @@
 using namespace std;
 
 
+static void atomic_add(atomic<double> &a, double w) {
+    // (!) no fetch_add for floating point atomics before C++20
+    double old = a.load(memory_order_relaxed);
+    while (!a.compare_exchange_weak(old, old + w, memory_order_relaxed)) ;
+}
+
+#ifdef SEARCH_STATS
+static unsigned long long ns_since(chrono::steady_clock::time_point t) {
+    return (unsigned long long) chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t).count();
+}
+#endif
+
+static proof_status proof_of_result(double w) {
+    /** what a terminal state's result proves (see MCTS_node::rollout_solved) */
+    return (w == 1.0) ? PROVEN_P1_WIN : (w == 0.0) ? PROVEN_P2_WIN : (w == 0.5) ? PROVEN_DRAW : UNPROVEN;
+}
+
+static double result_of_proof(proof_status p) {
+    return (p == PROVEN_P1_WIN) ? 1.0 : (p == PROVEN_P2_WIN) ? 0.0 : 0.5;
+}
+
+
+/*** Search statistics ***/
+void MCTS_search_counters::reset() {
+    search_ns = iterations = selections = selection_depth = max_selection_depth = selection_ns = 0;
+    expansions = expansion_ns = generation_ns = next_state_ns = 0;
+    rollouts = rollout_plies = rollout_ns = backpropagations = backpropagation_ns = solved_visits = 0;
+    evaluations = evaluation_batches = evaluation_ns = 0;
+}
+
+void MCTS_search_stats::print() const {
+    /** Times of the phases are summed over all threads so they may add up to more than the search in parallel modes */
+    #define PER(total, n) ((n) > 0 ? (total) / (n) : 0.0)
+    streamsize precision = cout.precision(3);
+    cout << "Search: " << iterations << " iterations in " << seconds << " s" << endl;
+    cout << "  selection:       " << selections << " x " << PER(selection_seconds, selections) * 1e6 << " us, mean depth "
+         << PER((double) selection_depth, selections) << " (max " << max_selection_depth << ")" << endl;
+    cout << "  expansion:       " << expansions << " x " << PER(expansion_seconds, expansions) * 1e6 << " us (move generation "
+         << PER(generation_seconds, expansions) * 1e6 << " us, next_state " << PER(next_state_seconds, expansions) * 1e6 << " us)" << endl;
+    cout << "  rollout:         " << rollouts << " x " << PER(rollout_seconds, rollouts) * 1e6 << " us";
+    if (rollout_plies > 0) cout << ", mean length " << PER((double) rollout_plies, rollouts) << " plies";    // (RAVE only)
+    cout << endl;
+    cout << "  backpropagation: " << backpropagations << " x " << PER(backpropagation_seconds, backpropagations) * 1e6 << " us" << endl;
+    if (evaluation_batches > 0) {
+        cout << "  evaluation:      " << evaluations << " leaves in " << evaluation_batches << " batches x "
+             << PER(evaluation_seconds, evaluation_batches) * 1e6 << " us" << endl;
+    }
+    if (solved_visits > 0) {
+        cout << "  solved:          " << solved_visits << " visits to terminal or proven nodes" << endl;
+    }
+    if (scheduler_jobs > 0) {
+        cout << "  scheduler:       " << scheduler_jobs << " jobs waited " << PER(scheduler_queue_wait_seconds, scheduler_jobs) * 1e6
+             << " us in the queue, lock held " << PER(scheduler_lock_hold_seconds, scheduler_lock_acquisitions) * 1e6 << " us x "
+             << scheduler_lock_acquisitions << endl;
+    }
+    cout.precision(precision);
+    #undef PER
+}
+
+string MCTS_search_stats::to_json() const {
+    ostringstream out;
+    out << setprecision(9) << "{\"seconds\":" << seconds << ",\"iterations\":" << iterations
+        << ",\"selections\":" << selections << ",\"selection_depth\":" << selection_depth << ",\"max_selection_depth\":" << max_selection_depth
+        << ",\"selection_seconds\":" << selection_seconds << ",\"expansions\":" << expansions << ",\"expansion_seconds\":" << expansion_seconds
+        << ",\"generation_seconds\":" << generation_seconds << ",\"next_state_seconds\":" << next_state_seconds
+        << ",\"rollouts\":" << rollouts << ",\"rollout_plies\":" << rollout_plies << ",\"rollout_seconds\":" << rollout_seconds
+        << ",\"backpropagations\":" << backpropagations << ",\"backpropagation_seconds\":" << backpropagation_seconds << ",\"solved_visits\":" << solved_visits
+        << ",\"evaluations\":" << evaluations << ",\"evaluation_batches\":" << evaluation_batches << ",\"evaluation_seconds\":" << evaluation_seconds
+        << ",\"scheduler_jobs\":" << scheduler_jobs << ",\"scheduler_lock_acquisitions\":" << scheduler_lock_acquisitions
+        << ",\"scheduler_queue_wait_seconds\":" << scheduler_queue_wait_seconds << ",\"scheduler_lock_hold_seconds\":" << scheduler_lock_hold_seconds << "}";
+    return out.str();
+}
+
+
+/*** MCTS ARENA ***/
+MCTS_arena::MCTS_arena()
+        : number_of_slabs(0), next_free(0), nodes_in_use(0), owned_bytes(0), budget(0), checkpoint_interval(1), checkpoint_visits(0),
+          widening_coefficient(0.0), widening_exponent(WIDENING_EXPONENT), rave_equivalence(0), exploration(EXPLORATION_CONSTANT),
+          rollouts_per_leaf(0) {}
+
+MCTS_arena::~MCTS_arena() {
+    for (unsigned int i = 0 ; i < number_of_slabs ; i++) {
+        ::operator delete(slabs[i]);
+    }
+}
+
+unsigned int MCTS_arena::widening_limit(unsigned int visits) const {
+    if (!widening()) return UINT_MAX;
+    return max(1u, (unsigned int) (widening_coefficient * pow((double) visits, widening_exponent)));
+}
+
+unsigned int MCTS_arena::allocate(unsigned int n) {
+    if (n == 0 || n > ARENA_SLAB_SIZE) {     // should not happen: every index we could return belongs to a live node
+        cerr << "Error: Invalid arena block size " << n << endl;
+        exit(EXIT_FAILURE);
+    }
+    unsigned int first;
+    lock.lock();
+    if (n < free_blocks.size() && !free_blocks[n].empty()) {
+        // recycle a block of the same size
+        first = free_blocks[n].back();
+        free_blocks[n].pop_back();
+    } else {
+        // blocks never span two slabs so that children are contiguous in memory
+        if (number_of_slabs == 0 || (next_free % ARENA_SLAB_SIZE) + n > ARENA_SLAB_SIZE || next_free % ARENA_SLAB_SIZE == 0) {
+            if (number_of_slabs > 0 && next_free % ARENA_SLAB_SIZE != 0) {
+                unsigned int left = ARENA_SLAB_SIZE - (next_free % ARENA_SLAB_SIZE);
+                if (free_blocks.size() <= left) free_blocks.resize(left + 1);
+                free_blocks[left].push_back(next_free);     // don't waste the rest of the last slab
+            }
+            if (number_of_slabs == ARENA_MAX_SLABS) {
+                lock.unlock();
+                cerr << "Error: MCTS arena is out of slabs!" << endl;
+                exit(EXIT_FAILURE);
+            }
+            slabs[number_of_slabs] = (MCTS_node *) ::operator new(ARENA_SLAB_SIZE * sizeof(MCTS_node));
+            next_free = number_of_slabs * ARENA_SLAB_SIZE;
+            number_of_slabs++;
+        }
+        first = next_free;
+        next_free += n;
+    }
+    lock.unlock();
+    nodes_in_use += n;
+    for (unsigned int i = first ; i < first + n ; i++) {
+        new (at(i)) MCTS_node();
+    }
+    return first;
+}
+
+void MCTS_arena::release(unsigned int first, unsigned int n) {
+    lock.lock();
+    if (free_blocks.size() <= n) free_blocks.resize(n + 1);
+    free_blocks[n].push_back(first);
+    lock.unlock();
+    nodes_in_use -= n;
+}
+
+
 /*** MCTS NODE ***/
-MCTS_node::MCTS_node(MCTS_node *parent, MCTS_state *state, const MCTS_move *move)
-        : parent(parent), state(state), move(move), score(0.0), number_of_simulations(0), size(0) {
-    children = new vector<MCTS_node *>();
-    children->reserve(STARTING_NUMBER_OF_CHILDREN);
-    untried_actions = state->actions_to_try();
+MCTS_node::MCTS_node()
+        : terminal(false), ready(false), proof(UNPROVEN), size(0), number_of_simulations(0), score(0.0), virtual_loss(0), amaf_visits(0), amaf_score(0.0),
+          player1(true), depth(0), state(NULL), move(NULL), arena(NULL), children_blocks(), children_capacity(0), max_children(0), number_of_children(0), move_id(-1),
+          parent(NULL), transposition(NULL), hash(0), untried_actions(NULL), next_action(NULL), generated_actions(0), all_actions_claimed(true) {}
+
+void MCTS_node::init(MCTS_arena *arena, MCTS_node *parent, MCTS_state *state, const MCTS_move *move) {
+    this->arena = arena;
+    this->parent = parent;
+    this->state = state;
+    this->move = move;
+    move_id = (move != NULL) ? move->id() : -1;
+    depth = (parent != NULL) ? parent->depth + 1 : 0;
     terminal = state->is_terminal();
+    player1 = state->player1_turn();
+    all_actions_claimed = terminal;     // (!) actions are only generated when the node is first expanded
+    account((long long) state->memory_usage());
 }
 
 MCTS_node::~MCTS_node() {
-    delete state;
-    delete move;
-    for (auto *child : *children) {
-        delete child;
-    }
-    delete children;
-    while (!untried_actions->empty()) {
-        delete untried_actions->front();    // if a move is here then it is not a part of a child node and needs to be deleted here
-        untried_actions->pop();
+    // (!) also empty slots, edges to shared nodes and nodes that don't keep their state
+    MCTS_state *s = state;
+    if (s != NULL) {
+        account(-(long long) s->memory_usage());
+        delete s;
     }
+    delete_move(move);
+    release_children();
+    delete_move(next_action);           // if a move is here then it is not a part of a child node and needs to be deleted here
+    delete_untried_actions();
+}
+
+/** Memory accounting (see MCTS_arena): a node accounts for its state, its move and, while it has untried actions, for its
+ * move generator and next_action. Moves taken from the generator move from its account to the node's (or its child's). */
+void MCTS_node::account(long long bytes) const {
+    if (arena != NULL) arena->account(bytes);
+}
+
+MCTS_move *MCTS_node::next_untried_action() {
+    long long before = (long long) untried_actions->memory_usage();
+    MCTS_move *m = untried_actions->next();
+    account((long long) untried_actions->memory_usage() - before + (m != NULL ? (long long) m->memory_usage() : 0));
+    if (m != NULL && generated_actions != UINT_MAX) generated_actions++;
+    return m;
+}
+
+void MCTS_node::delete_move(const MCTS_move *m) const {
+    if (m == NULL) return;
+    account(-(long long) m->memory_usage());
+    delete m;
+}
+
+void MCTS_node::delete_untried_actions() {
+    if (untried_actions == NULL) return;
+    account(-(long long) untried_actions->memory_usage());
     delete untried_actions;
+    untried_actions = NULL;
+}
+
+MCTS_state *MCTS_node::replay_state() const {
+    /** Rebuilds our state by replaying the moves from our nearest ancestor that keeps its state (the root always does).
+     * The caller owns the result. */
+    vector<const MCTS_move *> moves;
+    const MCTS_node *n = this;
+    const MCTS_state *from;
+    while ((from = n->state) == NULL) {
+        moves.push_back(n->move);
+        n = n->parent;
+    }
+    MCTS_state *s = NULL;
+    for (auto it = moves.rbegin() ; it != moves.rend() ; ++it) {
+        MCTS_state *next = (s != NULL) ? s->next_state(*it) : from->next_state(*it);
+        delete s;
+        s = next;
+    }
+    return s;
+}
+
+const MCTS_state *MCTS_node::acquire_state(MCTS_state *&scratch) {
+    /** Our state, rebuilt if we don't keep it. We keep it from now on if we have been visited often enough, otherwise it is
+     * returned in scratch too and the caller deletes it when done. Safe for concurrent callers (tree-parallel search). */
+    scratch = NULL;
+    MCTS_state *s = state;
+    if (s != NULL) return s;
+    s = replay_state();
+    unsigned int visits = arena->get_checkpoint_visits();
+    if (visits > 0 && number_of_simulations >= visits) {
+        MCTS_state *expected = NULL;
+        if (state.compare_exchange_strong(expected, s)) {
+            account((long long) s->memory_usage());
+            return s;
+        }
+        delete s;                       // another thread got there first
+        return expected;
+    }
+    scratch = s;
+    return s;
+}
+
+void MCTS_node::keep_state() {
+    /** Note: only when no other thread can be looking at this node */
+    if (state != NULL) return;
+    MCTS_state *s = replay_state();
+    account((long long) s->memory_usage());
+    state = s;
+}
+
+void MCTS_node::drop_state() {
+    /** After its first rollout a new node only keeps its state if it is a checkpoint: on every checkpoint_interval-th level
+     * (from the start of the game, so that checkpoints stay put when the tree advances) or terminal (rolled out again and again).
+     * Note: only before the node is made visible to other threads. */
+    unsigned int interval = arena->get_checkpoint_interval();
+    if (interval <= 1 || terminal || depth % interval == 0) return;
+    MCTS_state *s = state.exchange(NULL);
+    account(-(long long) s->memory_usage());
+    delete s;
+}
+
+void MCTS_node::collapse() {
+    /** Turns this node back into an unexpanded one that keeps its statistics (see MCTS_tree::prune): its subtree and its
+     * untried actions are freed and get generated again if the search comes back here */
+    release_children();
+    detach_children();
+    delete_move(next_action);
+    next_action = NULL;
+    delete_untried_actions();
+    generated_actions = 0;
+    all_actions_claimed = terminal;
+    if (!terminal) proof = UNPROVEN;     // (a proven root needs the children that prove it to pick a move)
+    for (MCTS_node *ancestor = parent ; ancestor != NULL ; ancestor = ancestor->parent) {
+        ancestor->size -= size;
+    }
+    size = 0;
+}
+
+/** Children blocks: block k holds children [CHILDREN_BLOCK * (2^k - 1), CHILDREN_BLOCK * (2^(k+1) - 1)) except for the
+ * last one, which holds all the children from there on. Blocks never move so other threads can read the children while
+ * a new block is added (its index is written before number_of_children is increased past it). */
+unsigned int MCTS_node::children_block_of(unsigned int i) {
+    unsigned int q = i / CHILDREN_BLOCK + 1;
+    unsigned int k = 31 - __builtin_clz(q);        // floor(log2(q))
+    return min(k, (unsigned int) CHILDREN_MAX_BLOCKS - 1);
+}
+
+static inline unsigned int children_block_start(unsigned int k) {
+    return CHILDREN_BLOCK * ((1u << k) - 1);
+}
+
+unsigned int MCTS_node::children_block_size(unsigned int k) const {
+    /** of an allocated block (the last one allocated may be smaller than the others would suggest) */
+    unsigned int left = children_capacity - children_block_start(k);
+    return (k + 1 < CHILDREN_MAX_BLOCKS) ? min(left, (unsigned int) CHILDREN_BLOCK << k) : left;
+}
+
+MCTS_node *MCTS_node::child(unsigned int i) const {
+    unsigned int k = children_block_of(i);
+    return arena->at(children_blocks[k] + i - children_block_start(k));
+}
+
+void MCTS_node::release_children() {
+    /** Destructs our children (and with them their subtrees) and releases their blocks. Note: call detach_children() after
+     * this if the node lives on. */
+    for (unsigned int k = 0 ; k < CHILDREN_MAX_BLOCKS && children_block_start(k) < children_capacity ; k++) {
+        unsigned int n = children_block_size(k);
+        for (unsigned int i = 0 ; i < n ; i++) {
+            arena->at(children_blocks[k] + i)->~MCTS_node();
+        }
+        arena->release(children_blocks[k], n);
+    }
+}
+
+void MCTS_node::generate_untried_actions(const MCTS_state *s) {
+    /** Creates our move generator or, if we dropped it (see add_child), creates it again and skips the moves that it had
+     * already yielded: the same state generates the same moves in the same order */
+    bool again = generated_actions > 0;
+    untried_actions = (arena->widening() && !again) ? new MCTS_priority_move_generator(s) : s->actions_generator();
+    if (max_children == 0) {       // (!) sized by the first generator: take_untried_actions() replaces it with a smaller one
+        max_children = untried_actions->max_number_of_moves();
+    }
+    if (arena->widening() && !again) {
+        generated_actions = UINT_MAX;     // (ranking the moves again would take longer than keeping them)
+    }
+    for (unsigned int i = 0 ; again && i < generated_actions ; i++) {
+        delete untried_actions->next();
+    }
+    account((long long) untried_actions->memory_usage());
+    if (!again) next_action = next_untried_action();
+}
+
+MCTS_move *MCTS_node::claim_untried_action(const MCTS_state *s) {
+    /** Note: expansion_lock must be held. Returns NULL if there are no untried actions left. s is our state (see acquire_state) */
+    if (untried_actions == NULL) {
+        if (all_actions_claimed) return NULL;
+        generate_untried_actions(s);
+    }
+    MCTS_move *m = next_action;
+    if (m != NULL) {
+        next_action = next_untried_action();
+    }
+    if (next_action == NULL) {
+        all_actions_claimed = true;
+    }
+    return m;
+}
+
+MCTS_node *MCTS_node::claim_child_slot() {
+    /** Note: expansion_lock must be held. Adds a block when the ones we have are full, up to one slot per possible action. */
+    if (number_of_children >= children_capacity) {
+        if (children_capacity >= max_children) return NULL;
+        unsigned int k = children_block_of(children_capacity);
+        unsigned int left = max_children - children_capacity;
+        unsigned int n = (k + 1 < CHILDREN_MAX_BLOCKS) ? min(left, (unsigned int) CHILDREN_BLOCK << k) : min(left, (unsigned int) ARENA_SLAB_SIZE);
+        children_blocks[k] = arena->allocate(n);
+        children_capacity += n;
+    }
+    MCTS_node *slot = child(number_of_children);
+    number_of_children.fetch_add(1, memory_order_release);
+    return slot;
+}
+
+void MCTS_node::detach_children() {
+    /** forget about our children blocks without touching them (someone else is now responsible for them) */
+    children_capacity = 0;
+    max_children = 0;
+    number_of_children = 0;
+}
+
+void MCTS_node::relocate_to(MCTS_node *slot) {
+    /** move this (ready) node with its subtree into an empty slot of the same arena, leaving this slot empty */
+    slot->terminal = terminal;
+    slot->proof = proof.load();
+    slot->size = size.load();
+    slot->number_of_simulations = number_of_simulations.load();
+    slot->score = score.load();
+    slot->virtual_loss = virtual_loss.load();
+    slot->amaf_visits = amaf_visits.load();
+    slot->amaf_score = amaf_score.load();
+    slot->move_id = move_id;
+    slot->player1 = player1;
+    slot->depth = depth;
+    slot->state = state.load();
+    slot->move = move;
+    slot->arena = arena;
+    copy(children_blocks, children_blocks + CHILDREN_MAX_BLOCKS, slot->children_blocks);
+    slot->children_capacity = children_capacity;
+    slot->max_children = max_children;
+    slot->number_of_children = number_of_children.load();
+    slot->parent = parent;
+    slot->transposition = NULL;
+    slot->hash = hash;
+    slot->untried_actions = untried_actions;
+    slot->next_action = next_action;
+    slot->generated_actions = generated_actions;
+    slot->all_actions_claimed = all_actions_claimed.load();
+    for (unsigned int i = 0 ; i < number_of_children ; i++) {
+        child(i)->parent = slot;
+    }
+    slot->ready.store(true, memory_order_release);
+    state = NULL;
+    move = NULL;
+    untried_actions = NULL;
+    next_action = NULL;
+    detach_children();
 }
 
-void MCTS_node::expand() {
-    if (is_terminal()) {              // can legitimately happen in end-game situations
-        rollout();                    // keep rolling out, eventually causing UCT to pick another node to expand due to exploration
+void MCTS_node::share(MCTS_node *shared) {
+    /** Turns this new (not yet ready) child into an edge to the node that already exists for the same state */
+    MCTS_state *s = state.exchange(NULL);
+    if (s != NULL) account(-(long long) s->memory_usage());
+    delete s;
+    transposition = shared;
+    terminal = shared->terminal;
+}
+
+void MCTS_node::expand(MCTS_rng &rng, search_mode mode) {
+    if (is_terminal() || is_proven()) {    // can legitimately happen in end-game situations
+        rollout(rng, mode);                // backpropagates the known result again (see rollout_solved)
         return;
-    } else if (is_fully_expanded()) {
-        cerr << "Warning: Cannot expanded this node any more!" << endl;
+    }
+    MCTS_node *new_node = add_child(mode);
+    if (new_node == NULL) {
+        if (mode == TREE_PARALLEL_SEARCH) {     // another thread claimed the last action and has not added its child yet
+            rollout(rng, mode);
+        } else {
+            cerr << "Warning: Cannot expanded this node any more!" << endl;
+        }
         return;
     }
-    // get next untried action
-    MCTS_move *next_move = untried_actions->front();     // get value
-    untried_actions->pop();                              // remove it
-    MCTS_state *next_state = state->next_state(next_move);
-    // build a new MCTS node from it
-    MCTS_node *new_node = new MCTS_node(this, next_state, next_move);
     // rollout, updating its stats
-    new_node->rollout();
-    // add new node to tree
-    children->push_back(new_node);
+    new_node->rollout(rng, mode);
+    new_node->drop_state();
+    // only now make it visible to select_best_child()
+    new_node->ready.store(true, memory_order_release);
+}
+
+MCTS_node *MCTS_node::add_child(search_mode mode) {
+    /** Adds a child for the next untried action but doesn't roll it out or make it visible yet (see expand()) */
+    // claim next untried action (atomically so that no two threads expand the same move)
+    MCTS_move *next_move = NULL;
+    MCTS_node *new_node = NULL;
+    #ifdef SEARCH_STATS
+    auto started = chrono::steady_clock::now();
+    #endif
+    MCTS_state *scratch;
+    const MCTS_state *s = acquire_state(scratch);
+    expansion_lock.lock();
+    #ifdef SEARCH_STATS
+    auto generating = chrono::steady_clock::now();
+    next_move = claim_untried_action(s);
+    arena->stats.generation_ns += ns_since(generating);
+    #else
+    next_move = claim_untried_action(s);
+    #endif
+    if (next_move != NULL) {
+        new_node = claim_child_slot();
+        if (new_node == NULL) {       // should not happen unless actions_generator() underestimated the number of moves
+            cerr << "Warning: More moves than max_number_of_moves()! Ignoring move " << next_move->sprint() << endl;
+            delete_move(next_move);
+            next_move = NULL;
+        }
+    }
+    if (scratch != NULL && next_action != NULL && generated_actions != UINT_MAX) {
+        // we don't keep our state (see MCTS_tree::set_checkpoints) so we don't keep the move generator that holds on to
+        // what it needs of it either: the next expansion creates it again from the rebuilt state
+        delete_untried_actions();
+    }
+    expansion_lock.unlock();
+    #ifdef SEARCH_STATS
+    auto playing = chrono::steady_clock::now();
+    #endif
+    MCTS_state *next_state = (next_move != NULL) ? s->next_state(next_move) : NULL;
+    #ifdef SEARCH_STATS
+    arena->stats.next_state_ns += ns_since(playing);
+    #endif
+    delete scratch;
+    if (next_move != NULL) {
+        // build a new MCTS node from it
+        new_node->init(arena, this, next_state, next_move);
+        if (uses_virtual_loss(mode)) {
+            new_node->add_virtual_loss();   // as if it had been selected (removed when backpropagating)
+        }
+    }
+    #ifdef SEARCH_STATS
+    arena->stats.expansions++;
+    arena->stats.expansion_ns += ns_since(started);
+    #endif
+    return new_node;
+}
+
+void MCTS_node::complete_rollout(double w, search_mode mode) {
+    /** Backpropagates the result of a rollout that was performed asynchronously (see MCTS_tree::grow_tree_pipelined) */
+    if (terminal) prove(proof_of_result(w));
+    #ifdef SEARCH_STATS
+    auto started = chrono::steady_clock::now();
+    backpropagate(w, 1, uses_virtual_loss(mode) ? VIRTUAL_LOSS : 0);
+    arena->stats.backpropagations++;
+    arena->stats.backpropagation_ns += ns_since(started);
+    #else
+    backpropagate(w, 1, uses_virtual_loss(mode) ? VIRTUAL_LOSS : 0);
+    #endif
+    if (!ready.load(memory_order_relaxed)) {      // (!) not for leaves that were rolled out again
+        drop_state();
+    }
+    ready.store(true, memory_order_release);
 }
 
-void MCTS_node::rollout() {
 #ifdef PARALLEL_ROLLOUTS
-    // schedule Jobs
-    static JobScheduler scheduler;               // static so that we don't create new threads every time (!)
-    double results[NUMBER_OF_THREADS]{-1};
-    for (int i = 0 ; i < NUMBER_OF_THREADS ; i++) {
-        scheduler.schedule(new RolloutJob(state, &results[i]));
+static unsigned int rollout_workers() {
+    /** More rollout workers than cores would only take turns: then fewer, bigger batches are better */
+    unsigned int cores = thread::hardware_concurrency();
+    return (cores == 0 || cores >= ROLLOUTS_PER_ITERATION) ? ROLLOUTS_PER_ITERATION : cores;
+}
+#endif
+
+void MCTS_node::rollout_solved(MCTS_rng &rng, search_mode mode) {
+    /** MCTS-Solver: the result of a terminal or proven node is known so it is backpropagated as is instead of simulated
+     * (again and again). A terminal node is proven by its first result if that is a win, a loss or a draw. */
+    proof_status p = proof.load(memory_order_acquire);
+    double w;
+    if (p == UNPROVEN) {
+        MCTS_state *scratch;
+        const MCTS_state *s = acquire_state(scratch);
+        MCTS_rng rollout_rng = rng.split();
+        w = s->rollout(rollout_rng);
+        delete scratch;
+        prove(proof_of_result(w));
+    } else {
+        w = result_of_proof(p);
+    }
+    // weigh it like the rollouts of any other iteration
+    const unsigned int per_leaf = arena->get_rollouts_per_leaf();
+#ifdef PARALLEL_ROLLOUTS
+    const int n = (mode != SERIAL_SEARCH) ? 1 : (per_leaf > 0) ? (int) per_leaf : ROLLOUTS_PER_ITERATION;
+#else
+    const int n = (mode == SERIAL_SEARCH && per_leaf > 0) ? (int) per_leaf : 1;
+#endif
+    backpropagate(w * n, n, uses_virtual_loss(mode) ? VIRTUAL_LOSS : 0);
+    if (arena->get_rave_equivalence() > 0) {
+        for (int i = 0 ; i < n ; i++) update_amaf(vector<int>(), w);
+    }
+    #ifdef SEARCH_STATS
+    arena->stats.solved_visits++;
+    #endif
+}
+
+void MCTS_node::rollout(MCTS_rng &rng, search_mode mode) {
+    if (terminal || is_proven()) {
+        rollout_solved(rng, mode);
+        return;
     }
+    MCTS_state *scratch;
+    const MCTS_state *s = acquire_state(scratch);
+    const bool rave = arena->get_rave_equivalence() > 0;
+    const bool record = rave;        // (!) not for SEARCH_STATS: the moves cost a vector per rollout
+    #ifdef SEARCH_STATS
+    auto started = chrono::steady_clock::now();
+    #endif
+    if (mode != SERIAL_SEARCH) {
+        // the parallelism comes from the threads growing the tree(s) so perform a single rollout here
+        MCTS_rng rollout_rng = rng.split();
+        vector<int> played;
+        double w = record ? s->rollout_with_moves(rollout_rng, played) : s->rollout(rollout_rng);
+        delete scratch;
+        #ifdef SEARCH_STATS
+        arena->stats.rollouts++;
+        arena->stats.rollout_plies += played.size();
+        arena->stats.rollout_ns += ns_since(started);
+        started = chrono::steady_clock::now();
+        #endif
+        backpropagate(w, 1, uses_virtual_loss(mode) ? VIRTUAL_LOSS : 0);
+        if (rave) update_amaf(played, w);
+        #ifdef SEARCH_STATS
+        arena->stats.backpropagations++;
+        arena->stats.backpropagation_ns += ns_since(started);
+        #endif
+        return;
+    }
+    const unsigned int per_leaf = arena->get_rollouts_per_leaf();
+    if (per_leaf > 0) {
+        // a batch of the tree's own size on this thread (see MCTS_tree::set_rollouts_per_leaf)
+        vector<MCTS_rng> rngs(per_leaf);
+        vector<double> results(per_leaf);
+        vector<vector<int>> played(record ? per_leaf : 0);
+        for (unsigned int i = 0 ; i < per_leaf ; i++) {
+            rngs[i] = rng.split();
+        }
+        s->rollout_batch(per_leaf, rngs.data(), results.data(), record ? played.data() : NULL);
+        delete scratch;
+        #ifdef SEARCH_STATS
+        arena->stats.rollouts += per_leaf;
+        for (const vector<int> &p : played) arena->stats.rollout_plies += p.size();
+        arena->stats.rollout_ns += ns_since(started);
+        started = chrono::steady_clock::now();
+        #endif
+        double score_sum = 0.0;
+        for (double w : results) score_sum += w;
+        backpropagate(score_sum, per_leaf, 0);
+        if (rave) {
+            for (unsigned int i = 0 ; i < per_leaf ; i++) update_amaf(played[i], results[i]);
+        }
+        #ifdef SEARCH_STATS
+        arena->stats.backpropagations++;
+        arena->stats.backpropagation_ns += ns_since(started);
+        #endif
+        return;
+    }
+#ifdef PARALLEL_ROLLOUTS
+    // one batch per worker (Jobs on the stack since the scheduler won't delete them) so that the state can share its
+    // setup among the simulations of a batch (see MCTS_state::rollout_batch)
+    // (!) streams are split off in simulation order so results don't depend on the batches or which thread runs them
+    static WorkStealingScheduler scheduler(rollout_workers());    // static so that we don't create new threads every time (!)
+    const unsigned int workers = scheduler.get_number_of_threads();
+    MCTS_rng rngs[ROLLOUTS_PER_ITERATION];
+    double results[ROLLOUTS_PER_ITERATION];
+    vector<int> played[ROLLOUTS_PER_ITERATION];
+    RolloutBatchJob jobs[ROLLOUTS_PER_ITERATION];
+    Job *batch[ROLLOUTS_PER_ITERATION];
+    for (int i = 0 ; i < ROLLOUTS_PER_ITERATION ; i++) {
+        rngs[i] = rng.split();
+    }
+    unsigned int number_of_jobs = 0;
+    for (unsigned int w = 0 ; w < workers ; w++) {
+        unsigned int first = w * ROLLOUTS_PER_ITERATION / workers, last = (w + 1) * ROLLOUTS_PER_ITERATION / workers;
+        if (first == last) continue;
+        jobs[number_of_jobs].set_batch(s, last - first, rngs + first, results + first, record ? played + first : NULL);
+        batch[number_of_jobs] = &jobs[number_of_jobs];
+        number_of_jobs++;
+    }
+    scheduler.schedule_batch(batch, number_of_jobs);
     // wait for all simulations to finish
     scheduler.waitUntilJobsHaveFinished();
+    delete scratch;
+    #ifdef SEARCH_STATS
+    arena->stats.rollouts += ROLLOUTS_PER_ITERATION;
+    for (int i = 0 ; i < ROLLOUTS_PER_ITERATION ; i++) arena->stats.rollout_plies += played[i].size();
+    arena->stats.rollout_ns += ns_since(started);
+    started = chrono::steady_clock::now();
+    #endif
     // aggregate results
     double score_sum = 0.0;
-    for (int i = 0 ; i < NUMBER_OF_THREADS ; i++) {
+    for (int i = 0 ; i < ROLLOUTS_PER_ITERATION ; i++) {
         if (results[i] >= 0.0 && results[i] <= 1.0){
             score_sum += results[i];
         } else {    // should not happen
             cerr << "Warning: Invalid result when aggregating parallel rollouts" << endl;
         }
     }
-    backpropagate(score_sum, NUMBER_OF_THREADS);
+    backpropagate(score_sum, ROLLOUTS_PER_ITERATION, 0);
+    if (rave) {
+        for (int i = 0 ; i < ROLLOUTS_PER_ITERATION ; i++) update_amaf(played[i], results[i]);
+    }
 #else
-    double w = state->rollout();
-    backpropagate(w, 1);
+    MCTS_rng rollout_rng = rng.split();
+    vector<int> played;
+    double w = record ? s->rollout_with_moves(rollout_rng, played) : s->rollout(rollout_rng);
+    delete scratch;
+    #ifdef SEARCH_STATS
+    arena->stats.rollouts++;
+    arena->stats.rollout_plies += played.size();
+    arena->stats.rollout_ns += ns_since(started);
+    started = chrono::steady_clock::now();
+    #endif
+    backpropagate(w, 1, 0);
+    if (rave) update_amaf(played, w);
 #endif
+    #ifdef SEARCH_STATS
+    arena->stats.backpropagations++;
+    arena->stats.backpropagation_ns += ns_since(started);
+    #endif
+}
+
+void MCTS_node::update_amaf(const vector<int> &played, double w) {
+    /** RAVE: a move that is played later on by the same player (move ids tell the players apart) counts as if it had been
+     * played first. Going up our path, every child whose move was played after its parent (in the tree below it or in the
+     * rollout) gets w added to its all-moves-as-first statistics. */
+    vector<bool> seen;
+    for (int id : played) {
+        if (id < 0) continue;
+        if ((size_t) id >= seen.size()) seen.resize(id + 1, false);
+        seen[id] = true;
+    }
+    const MCTS_node *prev = NULL;
+    for (MCTS_node *node = this ; node != NULL ; prev = node, node = node->parent) {
+        unsigned int count = node->number_of_children.load(memory_order_acquire);
+        for (unsigned int i = 0 ; i < count ; i++) {
+            MCTS_node *child = node->child(i);
+            // (!) the new node that we are coming from is not ready yet but it is ours
+            if (child != prev && !child->ready.load(memory_order_acquire)) continue;
+            int id = child->move_id;
+            if (id >= 0 && (size_t) id < seen.size() && seen[id]) {
+                atomic_add(child->amaf_score, w);
+                child->amaf_visits++;
+            }
+        }
+        if (node->move_id >= 0) {
+            if ((size_t) node->move_id >= seen.size()) seen.resize(node->move_id + 1, false);
+            seen[node->move_id] = true;
+        }
+    }
 }
 
-void MCTS_node::backpropagate(double w, int n) {
-    score += w;
+void MCTS_node::backpropagate(double w, int n, unsigned int vl) {
+    atomic_add(score, w);
     number_of_simulations += n;
     if (parent != NULL) {
+        virtual_loss -= vl;          // every node on the selected path except the root has been given a virtual loss
         parent->size++;
-        parent->backpropagate(w, n);
+        parent->backpropagate(w, n, vl);
+    }
+}
+
+bool MCTS_node::wins_for_us(proof_status p) const {
+    /** whether p is a win for the player to move here */
+    return p == (player1 ? PROVEN_P1_WIN : PROVEN_P2_WIN);
+}
+
+void MCTS_node::prove(proof_status p) {
+    /** Proofs are final: only the first one counts (threads may race to prove the same node) */
+    proof_status expected = UNPROVEN;
+    if (p == UNPROVEN || !proof.compare_exchange_strong(expected, p)) return;
+    if (parent != NULL) parent->update_proof();
+}
+
+void MCTS_node::update_proof() {
+    /** MCTS-Solver, after one of our children has been proven: we are won if any of our moves wins for the player to move
+     * here, or decided once all of our moves have been tried and proven (a draw if one of them draws, otherwise lost).
+     * Note: the proven child may not be ready yet (its first rollout is what proved it). Shared nodes only prove the parent
+     * they were last reached from. */
+    if (is_proven()) return;
+    // (!) under the lock: the last action gets claimed before its child slot
+    expansion_lock.lock();
+    bool all_proven = all_actions_claimed;
+    unsigned int count = number_of_children;
+    expansion_lock.unlock();
+    bool draw = false;
+    for (unsigned int i = 0 ; i < count ; i++) {
+        proof_status p = child(i)->resolve()->proof.load(memory_order_acquire);
+        if (p == UNPROVEN) {
+            all_proven = false;
+        } else if (wins_for_us(p)) {
+            prove(p);
+            return;
+        } else if (p == PROVEN_DRAW) {
+            draw = true;
+        }
+    }
+    if (all_proven && count > 0) {
+        prove(draw ? PROVEN_DRAW : (player1 ? PROVEN_P2_WIN : PROVEN_P1_WIN));
     }
 }
 
 bool MCTS_node::is_fully_expanded() const {
-    return is_terminal() || untried_actions->empty();
+    return is_terminal() || all_actions_claimed;
+}
+
+bool MCTS_node::is_expandable() const {
+    /** With progressive widening a node only gets another child once it has been visited enough: until then the search
+     * goes on through the children it has, which are its best moves so far according to the game (see action_priorities) */
+    return !is_fully_expanded() && number_of_children < arena->widening_limit(number_of_simulations);
 }
 
 bool MCTS_node::is_terminal() const {
@@ -103,20 +788,53 @@ unsigned int MCTS_node::get_size() const {
 
 MCTS_node *MCTS_node::select_best_child(double c) const {
     /** selects best child based on the winrate of whose turn it is to play */
-    if (children->empty()) return NULL;
-    else if (children->size() == 1) return children->at(0);
+    unsigned int count = number_of_children.load(memory_order_acquire);
+    if (count == 0) return NULL;
+    else if (count == 1) {
+        MCTS_node *only = child(0);
+        if (!only->ready.load(memory_order_acquire)) return NULL;
+        return (c > 0 && only->resolve()->is_proven()) ? NULL : only;     // (see below)
+    }
     else {
         double uct, max = -1;
         MCTS_node *argmax = NULL;
-        for (auto *child : *children) {
-            double winrate = child->score / ((double) child->number_of_simulations);
+        bool player1turn = player1;
+        const double rave_k = (double) arena->get_rave_equivalence();
+        for (unsigned int i = 0 ; i < count ; i++) {
+            MCTS_node *child = this->child(i);
+            if (!child->ready.load(memory_order_acquire)) continue;     // (tree-parallel) still being expanded
+            const MCTS_node *stats = child->resolve();                  // (!) shared nodes keep a single set of statistics
+            proof_status p = stats->proof.load(memory_order_acquire);
+            if (p != UNPROVEN) {
+                // MCTS-Solver: nothing left to search there. When choosing a move, a proven win beats any other move and a
+                // proven loss loses to any other move.
+                if (c > 0) continue;
+                uct = wins_for_us(p) ? 2.0 : (p == PROVEN_DRAW) ? 0.5 : -0.5;
+                if (uct > max) {
+                    max = uct;
+                    argmax = child;
+                }
+                continue;
+            }
+            // virtual losses count as visits that were lost for whoever is choosing (always 0 unless tree-parallel)
+            unsigned int vl = stats->virtual_loss;
+            double n = (double) (stats->number_of_simulations + vl);
+            double winrate = (stats->score + (player1turn ? 0.0 : (double) vl)) / n;
             // If its the opponent's move apply UCT based on his winrate i.e. our loss rate.   <-------
-            if (!state->player1_turn()){
+            if (!player1turn){
                 winrate = 1.0 - winrate;
             }
+            // RAVE (while searching): blend in the all-moves-as-first winrate, less and less as the move gets visits itself
+            unsigned int amaf_n = child->amaf_visits;
+            if (c > 0 && rave_k > 0 && amaf_n > 0) {
+                double amaf = child->amaf_score / amaf_n;
+                if (!player1turn) amaf = 1.0 - amaf;
+                double beta = sqrt(rave_k / (3.0 * n + rave_k));
+                winrate = (1.0 - beta) * winrate + beta * amaf;
+            }
             if (c > 0) {
                 uct = winrate +
-                      c * sqrt(log((double) this->number_of_simulations) / ((double) child->number_of_simulations));
+                      c * sqrt(log((double) (this->number_of_simulations + this->virtual_loss)) / n);
             } else {
                 uct = winrate;
             }
@@ -129,25 +847,47 @@ MCTS_node *MCTS_node::select_best_child(double c) const {
     }
 }
 
-MCTS_node *MCTS_node::advance_tree(const MCTS_move *m) {
-    // Find child with this m and delete all others
+MCTS_node *MCTS_node::advance_tree(const MCTS_move *m, unsigned int &block, unsigned int &block_size, MCTS_garbage &garbage) {
+    /** Returns the next root and the arena block that it lives in (it is the caller's to release later).
+     * All other children and our other children blocks (all of them if the next root is new) are added to the garbage instead of deleted. */
+    // Find child with this m and discard all others
     MCTS_node *next = NULL;
-    for (auto *child: *children) {
-        if (*(child->move) == *(m)) {
+    unsigned int next_block = CHILDREN_MAX_BLOCKS;
+    for (unsigned int i = 0 ; i < number_of_children ; i++) {
+        MCTS_node *child = this->child(i);
+        if (next == NULL && *(child->move) == *(m)) {
             next = child;
+            next_block = children_block_of(i);
+        } else {
+            garbage.nodes.push_back(child);
+        }
+    }
+    for (unsigned int k = 0 ; k < CHILDREN_MAX_BLOCKS && children_block_start(k) < children_capacity ; k++) {
+        if (k == next_block) {
+            // this children block now hosts the next root
+            block = children_blocks[k];
+            block_size = children_block_size(k);
         } else {
-            delete child;
+            garbage.blocks.push_back(make_pair(children_blocks[k], children_block_size(k)));
         }
     }
-    // remove children from queue so that they won't be re-deleted by the destructor when this node dies (!)
-    this->children->clear();
+    // forget children so that they won't be re-deleted by the destructor when this node dies (!)
+    detach_children();
     // if not found then we have to create a new node
     if (next == NULL) {
         // Note: UCT may lead to not fully explored tree even for short-term children due to terminal nodes being chosen
-        cout << "INFO: Didn't find child node. Had to start over." << endl;
-        MCTS_state *next_state = state->next_state(m);
-        next = new MCTS_node(NULL, next_state, NULL);
+        // (MCTS_tree::advance_tree reports it: a new root has no move)
+        MCTS_state *next_state = state.load()->next_state(m);
+        block = arena->allocate(1);
+        block_size = 1;
+        next = arena->at(block);
+        next->init(arena, NULL, next_state, NULL);
+        next->depth = depth + 1;
+        next->ready = true;
     } else {
+        if (next->state == NULL) {       // (!) the root always keeps its state
+            next->keep_state();
+        }
         next->parent = NULL;     // make parent NULL
         // IMPORTANT: m and next->move can be the same here if we pass the move from select_best_child()
         // (which is what we will typically be doing). If not then it's the caller's responsibility to delete m (!)
@@ -157,62 +897,685 @@ MCTS_node *MCTS_node::advance_tree(const MCTS_move *m) {
 }
 
 
+void MCTS_node::take_untried_actions(const function<bool(const MCTS_move *)> &matches, vector<MCTS_move *> &taken) {
+    /** Takes the untried actions that match out of our untried actions (by generating all of them) and appends them to
+     * taken in generation order */
+    if (untried_actions == NULL) {
+        generate_untried_actions(state.load());
+    }
+    queue<MCTS_move *> *remaining = new queue<MCTS_move *>();
+    long long moved = 0;                 // bytes of the moves handed over to the new generator
+    for (MCTS_move *a = next_action ; a != NULL ; a = next_untried_action()) {
+        if (matches(a)) {
+            taken.push_back(a);
+        } else {
+            remaining->push(a);
+            moved += (long long) a->memory_usage();
+        }
+    }
+    delete_untried_actions();
+    untried_actions = new MCTS_queue_move_generator(remaining);
+    account((long long) untried_actions->memory_usage() - moved);
+    generated_actions = UINT_MAX;        // (!) our state does not generate these any more
+    next_action = next_untried_action();
+    all_actions_claimed = (next_action == NULL);
+}
+
+bool MCTS_node::remove_untried_action(const MCTS_move *m) {
+    /** Takes m out of our untried actions. Returns false if it was not there. */
+    vector<MCTS_move *> taken;
+    take_untried_actions([m, &taken](const MCTS_move *a) { return taken.empty() && *a == *m; }, taken);
+    if (taken.empty()) return false;
+    delete_move(taken[0]);
+    return true;
+}
+
+unsigned int MCTS_node::seed(const MCTS_book &book, const MCTS_book_record *record, unsigned int levels) {
+    /** Adds the children of record, the book's record of our state, as if they had been searched (and theirs, up to levels
+     * deep). Their moves are taken from our untried actions by id. Returns the number of nodes added. */
+    if (levels == 0 || terminal || record->number_of_children == 0) return 0;
+    unordered_map<int, const MCTS_book_record *> wanted;
+    for (unsigned int i = 0 ; i < record->number_of_children ; i++) {
+        const MCTS_book_record *r = book.child(record, i);
+        wanted[r->move_id] = r;
+    }
+    vector<MCTS_move *> moves;
+    take_untried_actions([&wanted](const MCTS_move *a) { return wanted.count(a->id()) > 0; }, moves);
+    if (moves.size() < wanted.size()) {
+        cerr << "Warning: " << wanted.size() - moves.size() << " moves of the opening book are not legal here. Skipping them." << endl;
+    }
+    unsigned int added = 0;
+    for (MCTS_move *m : moves) {
+        const MCTS_book_record *r = wanted[m->id()];
+        MCTS_state *next_state = state.load()->next_state(m);
+        unsigned long long h = (book.has_hashes() && r->hash != 0) ? next_state->hash() : 0;
+        if (h != 0 && h != r->hash) {    // (!) the move is lost to the search but that can only be a corrupt book
+            cerr << "Warning: Move " << r->move_id << " of the opening book does not lead to its position. Skipping it." << endl;
+            delete next_state;
+            delete_move(m);
+            continue;
+        }
+        MCTS_node *slot = claim_child_slot();
+        if (slot == NULL) {              // should not happen unless actions_generator() underestimated the number of moves
+            cerr << "Warning: More moves than max_number_of_moves()! Ignoring move " << m->sprint() << endl;
+            delete next_state;
+            delete_move(m);
+            continue;
+        }
+        slot->init(arena, this, next_state, m);
+        slot->number_of_simulations = r->visits;
+        slot->score = r->score;
+        added += 1 + slot->seed(book, r, levels - 1);
+        slot->drop_state();
+        slot->ready.store(true, memory_order_release);
+    }
+    size += added;
+    return added;
+}
+
+void MCTS_node::merge_root(MCTS_node *other) {
+    /** Root-parallel search: add the statistics of another root for the same state to ours.
+     * Children that we don't have are moved over along with their subtrees. other is left without children.
+     * The subtrees of the children that we do have are deleted with other so only what we adopt adds to our size. */
+    for (unsigned int j = 0 ; j < other->number_of_children ; j++) {
+        MCTS_node *other_child = other->child(j);
+        MCTS_node *match = NULL;
+        for (unsigned int i = 0 ; i < number_of_children ; i++) {
+            if (*(child(i)->move) == *(other_child->move)) {
+                match = child(i);
+                break;
+            }
+        }
+        if (match != NULL) {
+            atomic_add(match->score, other_child->score);
+            match->number_of_simulations += other_child->number_of_simulations;
+            atomic_add(match->amaf_score, other_child->amaf_score);
+            match->amaf_visits += other_child->amaf_visits;
+            if (other_child->is_proven() && !match->is_proven()) match->proof = other_child->proof.load();
+        } else {
+            // the move is in our untried actions so remove it from there before adopting the child
+            MCTS_node *slot = NULL;
+            if (remove_untried_action(other_child->move)) {
+                slot = claim_child_slot();
+            }
+            if (slot == NULL) {      // should not happen
+                cerr << "Warning: Could not adopt a child when merging roots!" << endl;
+                continue;
+            }
+            other_child->parent = this;
+            other_child->relocate_to(slot);
+            size += 1 + slot->size;
+        }
+    }
+    atomic_add(score, other->score);
+    number_of_simulations += other->number_of_simulations;
+    if (other->is_proven()) {
+        proof = other->proof.load();
+    } else {
+        update_proof();              // (its children's proofs may add up to one now)
+    }
+}
+
+
 /*** MCTS TREE ***/
-MCTS_node *MCTS_tree::select(double c) {
-    MCTS_node *node = root;
-    while (!node->is_terminal()) {
-        if (!node->is_fully_expanded()) {
-            return node;
+MCTS_node *MCTS_tree::select(double c, search_mode mode) {
+    return select(root, c, mode);
+}
+
+MCTS_node *MCTS_tree::select(MCTS_node *from, double c, search_mode mode) {
+    MCTS_node *node = from;
+    #ifdef SEARCH_STATS
+    auto started = chrono::steady_clock::now();
+    unsigned long long depth = 0;
+    #endif
+    while (!node->is_terminal() && !node->is_proven()) {
+        if (node->is_expandable()) {
+            break;
         } else {
-            node = node->select_best_child(c);
+            MCTS_node *best_child = node->select_best_child(c);
+            if (best_child == NULL) {     // (tree-parallel) all actions claimed but no child has been added yet
+                if (node->is_fully_expanded()) node->update_proof();     // or all of them have been proven
+                break;
+            }
+            if (best_child->transposition != NULL) {
+                // shared node: backpropagate along the path that we actually took (only used by serial search)
+                best_child = best_child->transposition;
+                best_child->parent = node;
+            } else if (best_child->parent != node) {    // (!) a shared node that we last reached through some edge
+                best_child->parent = node;
+            }
+            node = best_child;
+            if (uses_virtual_loss(mode)) {
+                node->add_virtual_loss();    // discourage other threads from following the same path
+            }
+            #ifdef SEARCH_STATS
+            depth++;
+            #endif
         }
     }
+    #ifdef SEARCH_STATS
+    MCTS_search_counters &stats = from->arena->stats;
+    stats.selections++;
+    stats.selection_depth += depth;
+    unsigned long long deepest = stats.max_selection_depth.load(memory_order_relaxed);
+    while (depth > deepest && !stats.max_selection_depth.compare_exchange_weak(deepest, depth, memory_order_relaxed)) ;
+    stats.selection_ns += ns_since(started);
+    #endif
     return node;
 }
 
-MCTS_tree::MCTS_tree(MCTS_state *starting_state) {
+MCTS_tree::MCTS_tree(MCTS_state *starting_state, bool use_transpositions)
+        : search_scheduler(NULL), rollout_scheduler(NULL), reclaimer(NULL), transpositions(NULL), transposition_lookups(0), transposition_hits(0),
+          rng(random_device()() ^ ((unsigned long long) time(NULL) << 32)), stats_log(NULL), ponderer(NULL), stop_search(false),
+          pondering(false), pondered_iterations(0), evaluator(NULL), evaluation_batch(EVALUATION_BATCH),
+          evaluation_latency(EVALUATION_MAX_LATENCY), quiet(false) {
     assert(starting_state != NULL);
-    root = new MCTS_node(NULL, starting_state, NULL);
+    arena = new MCTS_arena();
+    root = allocate_root(starting_state, root_block);
+    root_block_size = 1;
+    if (use_transpositions) {
+        transpositions = new unordered_map<unsigned long long, MCTS_node *>();
+        rebuild_transpositions();
+    }
 }
 
 MCTS_tree::~MCTS_tree() {
-    delete root;
+    stop_pondering();
+    delete ponderer;
+    delete reclaimer;       // (!) waits for any discarded subtrees still being freed
+    delete search_scheduler;
+    delete rollout_scheduler;
+    delete transpositions;
+    root->~MCTS_node();     // frees the states, moves etc of the nodes
+    delete arena;           // frees the nodes themselves all at once
+}
+
+MCTS_node *MCTS_tree::allocate_root(MCTS_state *state, unsigned int &block) {
+    block = arena->allocate(1);
+    MCTS_node *node = arena->at(block);
+    node->init(arena, NULL, state, NULL);
+    node->ready = true;
+    return node;
+}
+
+int MCTS_tree::grow_tree(int max_iter, double max_time_in_seconds, unsigned int number_of_threads, search_mode mode) {
+    /** Returns the number of iterations made */
+    stop_pondering();       // (its iterations are kept)
+    return grow(max_iter, MCTS_deadline(max_time_in_seconds), number_of_threads, mode);
 }
 
-void MCTS_tree::grow_tree(int max_iter, double max_time_in_seconds) {
+int MCTS_tree::grow(int max_iter, MCTS_deadline deadline, unsigned int number_of_threads, search_mode mode) {
     MCTS_node *node;
-    double dt;
     #ifdef DEBUG
-    cout << "Growing tree..." << endl;
+    if (!quiet) cout << "Growing tree..." << endl;
     #endif
-    time_t start_t, now_t;
-    time(&start_t);
-    for (int i = 0 ; i < max_iter ; i++){
+    if (transpositions != NULL && (number_of_threads > 1 || mode == PIPELINED_SEARCH)) {
+        cerr << "Warning: Transpositions are only supported by serial search. Searching serially." << endl;
+        number_of_threads = 1;
+        mode = SERIAL_SEARCH;
+    }
+    if (evaluator != NULL && (number_of_threads > 1 || mode == PIPELINED_SEARCH)) {
+        cerr << "Warning: Leaves are evaluated in batches on the search's own thread. Searching serially." << endl;
+        number_of_threads = 1;
+        mode = SERIAL_SEARCH;
+    }
+    if ((mode == PIPELINED_SEARCH || evaluator != NULL) && arena->get_rave_equivalence() > 0) {
+        cerr << "Warning: " << (evaluator != NULL ? "Leaf evaluation" : "Pipelined search") << " does not update RAVE statistics." << endl;
+    }
+    int i = 0;
+    if (root->is_proven()) {
+        #ifdef DEBUG
+        if (!quiet) cout << "The current state is solved: nothing to search." << endl;
+        #endif
+        return 0;
+    }
+    if (evaluator != NULL || mode == PIPELINED_SEARCH || (number_of_threads > 1 && mode != SERIAL_SEARCH)) {
+        // the threads also stop when the tree outgrows its memory budget: prune it and carry on
+        // (!) merging root-parallel trees may have brought it back under budget already
+        do {
+            i += (evaluator != NULL) ? grow_tree_batched(max_iter - i, deadline)
+                 : (mode == PIPELINED_SEARCH) ? grow_tree_pipelined(max_iter - i, deadline, number_of_threads)
+                                              : grow_tree_parallel(max_iter - i, deadline, number_of_threads, mode);
+        } while (i < max_iter && !deadline.expired() && !root->is_proven() && (!arena->over_budget() || prune()));
+        #ifdef SEARCH_STATS
+        arena->stats.iterations += i;
+        arena->stats.search_ns += (unsigned long long) (deadline.elapsed() * 1e9);
+        #endif
+        return i;
+    }
+    for ( ; i < max_iter ; i++){
         // select node to expand according to tree policy
-        node = select();
+        node = select(arena->get_exploration());
         // expand it (this will perform a rollout and backpropagate the results)
-        node->expand();
+        if (transpositions != NULL) {
+            expand_shared(node);
+        } else {
+            node->expand(rng);
+        }
         // check if we need to stop
-        time(&now_t);
-        dt = difftime(now_t, start_t);
-        if (dt > max_time_in_seconds) {
+        if (arena->over_budget() && !prune()) {
+            cerr << "Warning: The tree is over its memory budget and cannot be pruned any further. Stopping early." << endl;
+            i++;
+            break;
+        }
+        if (root->is_proven()) {
+            #ifdef DEBUG
+            if (!quiet) cout << "Solved the current state after " << (i + 1) << " iterations." << endl;
+            #endif
+            i++;
+            break;
+        }
+        if (deadline.poll()) {
             #ifdef DEBUG
-            cout << "Early stopping: Made " << (i + 1) << " iterations in " << dt << " seconds." << endl;
+            if (!quiet) cout << "Early stopping: Made " << (i + 1) << " iterations in " << deadline.elapsed() << " seconds." << endl;
             #endif
+            i++;
             break;
         }
     }
     #ifdef DEBUG
-    time(&now_t);
-    dt = difftime(now_t, start_t);
-    cout << "Finished in " << dt << " seconds." << endl;
+    if (!quiet) cout << "Finished in " << deadline.elapsed() << " seconds." << endl;
+    #endif
+    #ifdef SEARCH_STATS
+    arena->stats.iterations += i;
+    arena->stats.search_ns += (unsigned long long) (deadline.elapsed() * 1e9);
+    #endif
+    return i;
+}
+
+int MCTS_tree::grow_tree_parallel(int max_iter, const MCTS_deadline &deadline, unsigned int number_of_threads, search_mode mode) {
+    /** Tree-parallel mode: every thread runs select -> expand -> rollout -> backpropagate on the same tree
+     *  Root-parallel mode: every thread grows its own tree from a clone of the root state. These get merged at the end. */
+    vector<MCTS_node *> ensemble;
+    vector<unsigned int> ensemble_blocks;
+    if (mode == ROOT_PARALLEL_SEARCH) {
+        for (unsigned int i = 1 ; i < number_of_threads ; i++) {
+            MCTS_state *state = get_current_state()->clone();
+            if (state == NULL) {
+                cerr << "Warning: MCTS_state::clone() is not implemented. Cannot use root-parallel search!" << endl;
+                break;
+            }
+            ensemble_blocks.push_back(0);
+            ensemble.push_back(allocate_root(state, ensemble_blocks.back()));
+            ensemble.back()->depth = root->depth;       // same checkpoints as ours
+        }
+    }
+    if (search_scheduler == NULL || search_scheduler->get_number_of_threads() != number_of_threads) {
+        delete search_scheduler;
+        search_scheduler = new JobScheduler(number_of_threads);
+        #ifdef SEARCH_STATS
+        search_scheduler->set_stats(true);
+        #endif
+    }
+    /** Every worker gets its own random stream (split off in worker order). Independent trees also get their own share
+     *  of the iterations so that, like serial search, root-parallel search is repeatable for a given seed. */
+    bool independent = (ensemble.size() + 1 == number_of_threads);
+    vector<atomic<int>> iterations(independent ? number_of_threads : 1);
+    for (auto &counter : iterations) counter = 0;
+    for (unsigned int i = 0 ; i < number_of_threads ; i++) {
+        // (!) if clone() failed the remaining threads share our own tree instead
+        MCTS_node *worker_root = (i > 0 && i <= ensemble.size()) ? ensemble[i - 1] : root;
+        search_mode worker_mode = independent ? mode : TREE_PARALLEL_SEARCH;
+        int worker_max_iter = independent ? max_iter / (int) number_of_threads + ((int) i < max_iter % (int) number_of_threads) : max_iter;
+        search_scheduler->schedule(new GrowTreeJob(worker_root, worker_mode, worker_max_iter, deadline,
+                                                   &iterations[independent ? i : 0], rng.split()));
+    }
+    search_scheduler->waitUntilJobsHaveFinished();
+    for (unsigned int i = 0 ; i < ensemble.size() ; i++) {
+        root->merge_root(ensemble[i]);
+        ensemble[i]->~MCTS_node();
+        arena->release(ensemble_blocks[i], 1);
+    }
+    int made = 0;
+    for (auto &counter : iterations) made += counter.load();
+    #ifdef DEBUG
+    if (!quiet) {
+        cout << "Made " << made << " iterations with " << number_of_threads
+             << " threads in " << deadline.elapsed() << " seconds." << endl;
+    }
     #endif
+    return made;
+}
+
+bool MCTS_tree::prune() {
+    /** Collapses the least visited subtrees (see MCTS_node::collapse) until the tree uses at most PRUNE_TO of its memory
+     * budget, deepest first among equally visited ones so that no node is collapsed after an ancestor of it.
+     * Returns false if that freed nothing. */
+    if (reclaimer != NULL) reclaimer->waitUntilJobsHaveFinished();   // (!) discarded subtrees count until they are freed
+    unsigned long before = arena->get_memory_usage();
+    unsigned long target = (unsigned long) (PRUNE_TO * arena->get_budget());
+    if (before <= target) return true;
+    vector<pair<MCTS_node *, unsigned int>> candidates;      // (node, depth) of every expanded node but the root
+    vector<pair<MCTS_node *, unsigned int>> to_visit(1, make_pair(root, 0u));
+    while (!to_visit.empty()) {
+        MCTS_node *n = to_visit.back().first;
+        unsigned int depth = to_visit.back().second;
+        to_visit.pop_back();
+        if (n != root && (n->children_capacity > 0 || n->untried_actions != NULL)) candidates.push_back(make_pair(n, depth));
+        for (unsigned int i = 0 ; i < n->number_of_children ; i++) {
+            MCTS_node *child = n->child(i);
+            if (child->transposition == NULL) to_visit.push_back(make_pair(child, depth + 1));
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const pair<MCTS_node *, unsigned int> &a, const pair<MCTS_node *, unsigned int> &b) {
+        unsigned int visits_a = a.first->number_of_simulations, visits_b = b.first->number_of_simulations;
+        return (visits_a != visits_b) ? visits_a < visits_b : a.second > b.second;
+    });
+    unsigned int collapsed = 0;
+    for (auto &candidate : candidates) {
+        if (arena->get_memory_usage() <= target) break;
+        candidate.first->collapse();
+        collapsed++;
+    }
+    #ifdef DEBUG
+    if (!quiet) cout << "Pruned " << collapsed << " subtrees: " << before / 1024 << " KB -> " << arena->get_memory_usage() / 1024 << " KB" << endl;
+    #endif
+    return arena->get_memory_usage() < before;
+}
+
+void MCTS_tree::set_checkpoints(unsigned int interval, unsigned int visits) {
+    /** New nodes only keep their state if they are on every interval-th level (1 = all, the default) or terminal, or once they
+     * have been visited at least visits times (0 = never). The states of the others are rebuilt when needed by replaying the
+     * moves from their nearest ancestor that keeps its state. Trades a few next_state() calls per iteration for memory. */
+    if (transpositions != NULL && interval != 1) {
+        cerr << "Warning: Checkpoints are not supported with transpositions. Every node keeps its state." << endl;
+        return;
+    }
+    arena->set_checkpoints(max(interval, 1u), visits);
+}
+
+void MCTS_tree::set_progressive_widening(double coefficient, double exponent) {
+    /** Nodes with n visits may have up to max(1, coefficient * n^exponent) children, tried in the order of the game's
+     * action_priorities(), so that deep lines are reached without first trying every move of every node on the way.
+     * Only affects nodes that have not generated their actions yet. */
+    arena->set_widening(max(coefficient, 0.0), exponent);
+}
+
+void MCTS_tree::set_rave(unsigned int equivalence) {
+    /** Rapid action value estimation: every node also keeps statistics over all rollouts through its parent that played its
+     * move at any later point (by the same player) and select() weighs them against its own with sqrt(k / (3 n + k)) for
+     * n visits, i.e. the same at k visits. Moves need an id() and the game's rollouts should report their moves with
+     * rollout_with_moves() (otherwise only the moves in the tree count). Pipelined search does not update these statistics. */
+    arena->set_rave(equivalence);
+}
+
+void MCTS_tree::set_leaf_evaluator(const MCTS_leaf_evaluator *e, unsigned int batch_size, double max_latency) {
+    /** Leaves get evaluated by e in batches of up to batch_size (see grow_tree_batched) instead of being rolled out, in any
+     * search mode (on the search's own thread). Their values count as one simulation each. */
+    if (transpositions != NULL && e != NULL) {
+        cerr << "Warning: Leaf evaluation is not supported with transpositions. Rolling out instead." << endl;
+        return;
+    }
+    evaluator = e;
+    evaluation_batch = max(batch_size, 1u);
+    evaluation_latency = max_latency;
+}
+
+void MCTS_tree::set_rollouts_per_leaf(unsigned int n) {
+    /** Serial search normally rolls a new leaf out ROLLOUTS_PER_ITERATION times on a thread pool shared by all trees (with
+     * PARALLEL_ROLLOUTS, otherwise once). With n > 0 it rolls it out n times with one rollout_batch() on the search's own
+     * thread instead, which is better when many trees search at once anyway (e.g. one game per core). Parallel search
+     * modes always roll leaves out once. */
+    arena->set_rollouts_per_leaf(n);
+}
+
+void MCTS_tree::set_memory_budget(unsigned long bytes) {
+    if (transpositions != NULL && bytes > 0) {
+        cerr << "Warning: Pruning is not supported with transpositions. Ignoring the memory budget." << endl;
+        return;
+    }
+    arena->set_budget(bytes);
+}
+
+void MCTS_tree::expand_shared(MCTS_node *node) {
+    /** Serial expansion that reuses the node of a state that has already been reached through another move order */
+    MCTS_node *new_node = node->is_terminal() ? NULL : node->add_child(SERIAL_SEARCH);
+    if (new_node == NULL) {
+        node->expand(rng);            // let it deal with terminal nodes etc
+        return;
+    }
+    new_node->hash = new_node->state.load()->hash();
+    MCTS_node *shared = NULL;
+    if (new_node->hash != 0) {
+        transposition_lookups++;
+        auto it = transpositions->find(new_node->hash);
+        if (it != transpositions->end()) {
+            shared = it->second;
+            transposition_hits++;
+        } else {
+            (*transpositions)[new_node->hash] = new_node;
+        }
+    }
+    if (shared != NULL) {
+        new_node->share(shared);
+        shared->parent = node;        // backpropagate through us this time
+        shared->rollout(rng);         // (!) shared nodes are always ready here since the search is serial
+    } else {
+        new_node->rollout(rng);
+    }
+    new_node->ready.store(true, memory_order_release);
+}
+
+void MCTS_tree::keep_shared_nodes(MCTS_node *next) {
+    /** Before advancing the tree to next: shared nodes that are reachable from next but are stored (owned) outside of
+     * next's subtree would be deleted along with the rest of the tree. Move each of them into one of the edges that
+     * point to it from within next's subtree. Their old slot becomes an edge itself (which gets deleted). */
+    auto resolve = [](MCTS_node *n) -> MCTS_node * {
+        while (n->transposition != NULL) n = n->transposition;     // edges to nodes that have been moved already
+        return n;
+    };
+    auto move_into = [](MCTS_node *edge, MCTS_node *shared) {
+        const MCTS_move *edge_move = edge->move, *shared_move = shared->move;
+        MCTS_node *edge_parent = edge->parent;
+        edge->move = NULL;
+        edge->transposition = NULL;
+        shared->relocate_to(edge);
+        edge->move = edge_move;
+        edge->parent = edge_parent;
+        shared->move = shared_move;
+        shared->share(edge);
+    };
+    if (next->transposition != NULL) {
+        move_into(next, resolve(next));
+    }
+    unordered_set<MCTS_node *> kept;
+    vector<MCTS_node *> to_visit(1, next), edges;
+    while (!to_visit.empty() || !edges.empty()) {
+        if (!to_visit.empty()) {
+            MCTS_node *n = to_visit.back();
+            to_visit.pop_back();
+            kept.insert(n);
+            for (unsigned int i = 0 ; i < n->number_of_children ; i++) {
+                MCTS_node *child = n->child(i);
+                child->parent = n;
+                if (child->transposition != NULL) {
+                    edges.push_back(child);
+                } else if (child->state != NULL) {
+                    to_visit.push_back(child);
+                }
+            }
+        } else {
+            MCTS_node *edge = edges.back();
+            edges.pop_back();
+            MCTS_node *shared = resolve(edge);
+            if (kept.count(shared) == 0) {
+                move_into(edge, shared);
+                to_visit.push_back(edge);
+            }
+        }
+    }
+}
+
+void MCTS_tree::rebuild_transpositions() {
+    /** Re-indexes the nodes of the current tree and points edges to wherever their shared node lives now */
+    transpositions->clear();
+    vector<MCTS_node *> to_visit(1, root), edges;
+    while (!to_visit.empty()) {
+        MCTS_node *n = to_visit.back();
+        to_visit.pop_back();
+        if (n->hash == 0) n->hash = n->state.load()->hash();
+        if (n->hash != 0) (*transpositions)[n->hash] = n;
+        for (unsigned int i = 0 ; i < n->number_of_children ; i++) {
+            MCTS_node *child = n->child(i);
+            child->parent = n;
+            if (child->transposition != NULL) {
+                edges.push_back(child);
+            } else if (child->state != NULL) {
+                to_visit.push_back(child);
+            }
+        }
+    }
+    for (MCTS_node *edge : edges) {
+        edge->transposition = (*transpositions)[edge->hash];
+    }
+}
+
+void MCTS_tree::grow_tree_worker(MCTS_node *root, search_mode mode, int max_iter, MCTS_deadline deadline,
+                                 atomic<int> *iterations, MCTS_rng &rng) {
+    while (true) {
+        if (iterations->fetch_add(1) >= max_iter) {     // (!) max_iter is shared between all threads of the same tree
+            iterations->fetch_sub(1);                  // so that it ends up holding the number of iterations made
+            break;
+        }
+        MCTS_node *node = select(root, root->arena->get_exploration(), mode);
+        node->expand(rng, mode);
+        if (deadline.poll() || root->arena->over_budget() || root->is_proven()) {     // (!) only the caller may prune (see grow_tree)
+            break;
+        }
+    }
+}
+
+int MCTS_tree::grow_tree_pipelined(int max_iter, const MCTS_deadline &deadline, unsigned int number_of_threads) {
+    /** Only this thread touches the tree: it keeps selecting and expanding leaves while the rollouts of previous ones
+     * run on the worker threads. Leaves waiting for their result hold a virtual loss (i.e. a pending visit) so that
+     * selection spreads over the tree. Results are backpropagated as soon as they show up in the completion queue. */
+    if (number_of_threads == 0) number_of_threads = 1;
+    if (rollout_scheduler == NULL || rollout_scheduler->get_number_of_threads() != number_of_threads) {
+        delete rollout_scheduler;
+        rollout_scheduler = new WorkStealingScheduler(number_of_threads);
+    }
+    const unsigned int depth = PIPELINE_DEPTH_PER_THREAD * number_of_threads;
+    CompletionQueue completed;
+    vector<AsyncRolloutJob> jobs(depth, AsyncRolloutJob(&completed));    // (!) reused: no allocation per rollout
+    vector<AsyncRolloutJob *> free_jobs;
+    for (auto &job : jobs) {
+        free_jobs.push_back(&job);
+    }
+    vector<AsyncRolloutJob *> done;
+    MCTS_deadline clock = deadline;
+    int iterations = 0;
+    bool stop = false;
+    while (free_jobs.size() < depth || !stop) {
+        // keep the pipeline full
+        while (!stop && !free_jobs.empty()) {
+            MCTS_node *node = select(arena->get_exploration(), PIPELINED_SEARCH);
+            if (node->is_terminal() || node->is_proven()) {
+                node->rollout(rng, PIPELINED_SEARCH);      // its result is known (see MCTS_node::rollout_solved): no job needed
+                stop = ++iterations >= max_iter || clock.poll() || arena->over_budget() || root->is_proven();
+                continue;
+            }
+            MCTS_node *leaf = node->add_child(PIPELINED_SEARCH);
+            if (leaf == NULL) {
+                leaf = node;                 // all of its children are still pending: roll it out again
+                leaf->keep_state();          // (!) the rollout runs on another thread after we return
+            }
+            AsyncRolloutJob *job = free_jobs.back();
+            free_jobs.pop_back();
+            job->set_leaf(leaf, rng.split());
+            rollout_scheduler->schedule(job);
+            stop = ++iterations >= max_iter || clock.poll() || arena->over_budget() || root->is_proven();
+        }
+        // backpropagate whatever has finished (waits for at least one result)
+        completed.pop_all(done, free_jobs.size() < depth);
+        for (auto *job : done) {
+            #ifdef SEARCH_STATS
+            arena->stats.rollouts++;
+            arena->stats.rollout_ns += job->ns;
+            #endif
+            job->get_leaf()->complete_rollout(job->score, PIPELINED_SEARCH);
+            free_jobs.push_back(job);
+        }
+        done.clear();
+    }
+    #ifdef DEBUG
+    if (!quiet) {
+        cout << "Made " << iterations << " pipelined iterations with " << number_of_threads
+             << " threads in " << deadline.elapsed() << " seconds." << endl;
+    }
+    #endif
+    return iterations;
+}
+
+int MCTS_tree::grow_tree_batched(int max_iter, const MCTS_deadline &deadline) {
+    /** Leaf evaluation: up to evaluation_batch leaves are selected and expanded, each holding a virtual loss so that the
+     * selections of a batch spread over the tree as in pipelined search. Then they are evaluated with a single call and
+     * their values backpropagated. A batch that is slow to fill up is evaluated after evaluation_latency seconds so that
+     * selection does not go on for long with statistics that are missing the pending leaves. */
+    vector<MCTS_node *> leaves;
+    vector<const MCTS_state *> states;
+    vector<double> values;
+    leaves.reserve(evaluation_batch);
+    states.reserve(evaluation_batch);
+    MCTS_deadline clock = deadline;
+    int iterations = 0;
+    bool stop = false;
+    while (!stop) {
+        MCTS_deadline batch_clock(evaluation_latency);
+        do {
+            MCTS_node *node = select(arena->get_exploration(), PIPELINED_SEARCH);
+            if (node->is_terminal() || node->is_proven()) {
+                node->rollout(rng, PIPELINED_SEARCH);      // its result is known (see MCTS_node::rollout_solved)
+            } else {
+                MCTS_node *leaf = node->add_child(PIPELINED_SEARCH);
+                if (leaf == NULL) {
+                    leaf = node;                 // all of its children are pending in this batch: evaluate it again
+                    leaf->keep_state();
+                }
+                if (leaf->is_terminal()) {       // its rollout is exact and proves it
+                    MCTS_rng rollout_rng = rng.split();
+                    leaf->complete_rollout(leaf->get_current_state()->rollout(rollout_rng), PIPELINED_SEARCH);
+                } else {
+                    leaves.push_back(leaf);
+                    states.push_back(leaf->get_current_state());
+                }
+            }
+            stop = ++iterations >= max_iter || clock.poll() || arena->over_budget() || root->is_proven();
+        } while (!stop && leaves.size() < evaluation_batch && !batch_clock.poll());
+        if (leaves.empty()) continue;
+        #ifdef SEARCH_STATS
+        auto started = chrono::steady_clock::now();
+        #endif
+        values.assign(leaves.size(), -1.0);
+        evaluator->evaluate(states.data(), (unsigned int) states.size(), values.data());
+        #ifdef SEARCH_STATS
+        arena->stats.evaluations += leaves.size();
+        arena->stats.evaluation_batches++;
+        arena->stats.evaluation_ns += ns_since(started);
+        #endif
+        for (size_t i = 0 ; i < leaves.size() ; i++) {
+            if (values[i] < 0.0 || values[i] > 1.0) {     // should not happen
+                cerr << "Warning: Invalid leaf value " << values[i] << endl;
+                values[i] = 0.5;
+            }
+            leaves[i]->complete_rollout(values[i], PIPELINED_SEARCH);
+        }
+        leaves.clear();
+        states.clear();
+    }
+    #ifdef DEBUG
+    if (!quiet) cout << "Made " << iterations << " iterations with batched leaf evaluation in " << deadline.elapsed() << " seconds." << endl;
+    #endif
+    return iterations;
 }
 
 unsigned int MCTS_tree::get_size() const {
     return root->get_size();
 }
 
+unsigned long MCTS_tree::get_node_memory() const {
+    return (unsigned long) arena->get_number_of_slabs() * ARENA_SLAB_SIZE * sizeof(MCTS_node);
+}
+
 const MCTS_move *MCTS_node::get_move() const {
     return move;
 }
@@ -225,42 +1588,195 @@ void MCTS_node::print_stats() const {
         cout << "Tree not expanded yet" << endl;
         return;
     }
+    vector<const MCTS_node *> children;
+    for (unsigned int i = 0 ; i < number_of_children ; i++) {
+        children.push_back(child(i));
+    }
     cout << "___ INFO _______________________" << endl
          << "Tree size: " << size << endl
          << "Number of simulations: " << number_of_simulations << endl
-         << "Branching factor at root: " << children->size() << endl
+         << "Branching factor at root: " << children.size() << endl
          << "Chances of P1 winning: " << setprecision(4) << 100.0 * (score / number_of_simulations) << "%" << endl;
+    static const char *proofs[] = {"", " (proven P1 win)", " (proven P2 win)", " (proven draw)"};
+    if (is_proven()) cout << "Solved:" << proofs[get_proof()] << endl;
     // sort children based on winrate of player's turn for this node (!)
-    if (state->player1_turn()) {
-        std::sort(children->begin(), children->end(), [](const MCTS_node *n1, const MCTS_node *n2){
+    if (player1) {
+        std::sort(children.begin(), children.end(), [](const MCTS_node *n1, const MCTS_node *n2){
             return n1->calculate_winrate(true) > n2->calculate_winrate(true);
         });
     } else {
-        std::sort(children->begin(), children->end(), [](const MCTS_node *n1, const MCTS_node *n2){
+        std::sort(children.begin(), children.end(), [](const MCTS_node *n1, const MCTS_node *n2){
             return n1->calculate_winrate(false) > n2->calculate_winrate(false);
         });
     }
     // print TOPK of them along with their winrates
     cout << "Best moves:" << endl;
-    for (int i = 0 ; i < children->size() && i < TOPK ; i++) {
-        cout << "  " << i + 1 << ". " << children->at(i)->move->sprint() << "  -->  "
-             << setprecision(4) << 100.0 * children->at(i)->calculate_winrate(state->player1_turn()) << "%" << endl;
+    for (int i = 0 ; i < children.size() && i < TOPK ; i++) {
+        cout << "  " << i + 1 << ". " << children[i]->move->sprint() << "  -->  "
+             << setprecision(4) << 100.0 * children[i]->calculate_winrate(player1) << "%"
+             << proofs[children[i]->resolve()->get_proof()] << endl;
     }
     cout << "________________________________" << endl;
 }
 
 double MCTS_node::calculate_winrate(bool player1turn) const {
+    const MCTS_node *stats = resolve();
     if (player1turn) {
-        return score / number_of_simulations;
+        return stats->score / stats->number_of_simulations;
     } else {
-        return 1.0 - score / number_of_simulations;
+        return 1.0 - stats->score / stats->number_of_simulations;
     }
 }
 
 void MCTS_tree::advance_tree(const MCTS_move *move) {
+    stop_pondering();       // at the end of an iteration: whatever it found below the move is kept
+    // a new search starts from the next root
+    if (stats_log != NULL && arena->stats.iterations > 0) {
+        *stats_log << get_search_stats().to_json() << endl;
+    }
+    reset_search_stats();
     MCTS_node *old_root = root;
-    root = root->advance_tree(move);
-    delete old_root;       // this won't delete the new root since we have emptied old_root's children
+    unsigned int old_root_block = root_block, old_root_block_size = root_block_size;
+    if (transpositions != NULL) {
+        for (unsigned int i = 0 ; i < root->number_of_children ; i++) {
+            if (*(root->child(i)->move) == *move) {
+                keep_shared_nodes(root->child(i));
+                break;
+            }
+        }
+    }
+    MCTS_garbage garbage;
+    root = root->advance_tree(move, root_block, root_block_size, garbage);
+    if (!quiet && root->move == NULL) cout << "INFO: Didn't find child node. Had to start over." << endl;
+    garbage.nodes.push_back(old_root);     // this won't delete the new root since we have emptied old_root's children
+    garbage.blocks.push_back(make_pair(old_root_block, old_root_block_size));    // (!) only after the nodes in it are gone
+#ifdef BACKGROUND_RECLAMATION
+    // (!) a single thread so that garbage is freed in order: blocks discarded now may hold nodes discarded earlier
+    if (reclaimer == NULL) reclaimer = new JobScheduler(1);
+    reclaimer->schedule(new ReclaimJob(arena, garbage));
+#else
+    reclaim(arena, garbage);
+#endif
+    if (transpositions != NULL) {
+        rebuild_transpositions();
+    }
+}
+
+void MCTS_tree::start_pondering(int max_iter, unsigned int number_of_threads, search_mode mode) {
+    /** The search runs on the ponderer's thread exactly as grow_tree() would (without a time limit) so pondering can use
+     * any search mode. Stopping it sets stop_search, which every mode notices when it polls its deadline. */
+    stop_pondering();
+    if (root->is_terminal() || root->is_proven()) return;     // nothing to think about
+    if (ponderer == NULL) ponderer = new JobScheduler(1);
+    stop_search = false;
+    pondered_iterations = 0;
+    pondering = true;
+    ponderer->schedule(new PonderJob(this, max_iter, number_of_threads, mode));
+}
+
+void MCTS_tree::ponder(int max_iter, unsigned int number_of_threads, search_mode mode) {
+    /** Quietly: it runs in the background, e.g. while the user is asked for the opponent's move */
+    const bool was_quiet = quiet;
+    quiet = true;
+    pondered_iterations = grow(max_iter, MCTS_deadline(1e9, &stop_search), number_of_threads, mode);
+    quiet = was_quiet;
+}
+
+int MCTS_tree::stop_pondering() {
+    if (!pondering) return 0;
+    stop_search = true;
+    ponderer->waitUntilJobsHaveFinished();
+    stop_search = false;
+    pondering = false;
+    return pondered_iterations;
+}
+
+bool MCTS_tree::save_book(const string &path, unsigned int depth, unsigned int min_visits, bool hashes) const {
+    /** Writes the top depth levels of the tree below the root as an opening book (see book.h), leaving out the children
+     * with fewer than min_visits visits, so that a tree can start from it later (see load_book). Moves are stored by their
+     * id() so the game's moves need one. The hashes let load_book() check that the book is for the same positions. */
+    vector<MCTS_book_record> records;
+    vector<const MCTS_node *> nodes;             // nodes[i] is the node of records[i] (breadth-first)
+    vector<unsigned int> levels;
+    auto add = [&](const MCTS_node *node, unsigned int level) {
+        const MCTS_node *n = node->resolve();   // (!) shared nodes keep a single set of statistics
+        MCTS_book_record r;
+        r.hash = 0;
+        if (hashes) {
+            r.hash = n->hash;
+            if (r.hash == 0) {
+                MCTS_state *replayed = (n->state == NULL) ? n->replay_state() : NULL;
+                r.hash = (replayed != NULL) ? replayed->hash() : n->state.load()->hash();
+                delete replayed;
+            }
+        }
+        r.score = n->score;
+        r.visits = n->number_of_simulations;
+        r.move_id = (node == root) ? -1 : node->move_id;
+        r.first_child = 0;
+        r.number_of_children = 0;
+        records.push_back(r);
+        nodes.push_back(n);
+        levels.push_back(level);
+    };
+    if (root->number_of_simulations == 0) {
+        cerr << "Warning: The tree has not been searched yet. Not writing an empty opening book." << endl;
+        return false;
+    }
+    add(root, 0);
+    for (size_t i = 0 ; i < nodes.size() ; i++) {    // (nodes grows as we go)
+        records[i].first_child = (uint32_t) records.size();
+        if (levels[i] >= depth) continue;
+        unsigned int count = nodes[i]->number_of_children;
+        for (unsigned int j = 0 ; j < count ; j++) {
+            const MCTS_node *child = nodes[i]->child(j);
+            if (!child->ready || child->resolve()->number_of_simulations < max(min_visits, 1u)) continue;
+            if (child->move_id < 0) {
+                cerr << "Warning: Moves need an id() to be saved in an opening book." << endl;
+                return false;
+            }
+            add(child, levels[i] + 1);
+            records[i].number_of_children++;
+        }
+    }
+    return MCTS_book::write(path, records, hashes);
+}
+
+unsigned int MCTS_tree::load_book(const MCTS_book &book, unsigned int depth) {
+    /** Seeds a tree that has not been searched yet with an opening book of its current state: the book's top depth levels
+     * become nodes with the book's statistics, as if they had been searched. The book can be closed afterwards.
+     * Returns the number of nodes added. */
+    if (!book.is_open()) return 0;
+    if (root->number_of_simulations > 0 || root->untried_actions != NULL || root->children_capacity > 0) {
+        cerr << "Warning: Only a tree that has not been searched yet can start from an opening book." << endl;
+        return 0;
+    }
+    const MCTS_book_record *r = book.root();
+    unsigned long long h = (book.has_hashes() && r->hash != 0) ? get_current_state()->hash() : 0;
+    if (h != 0 && h != r->hash) {
+        cerr << "Warning: The opening book is for another position." << endl;
+        return 0;
+    }
+    root->number_of_simulations = r->visits;
+    root->score = r->score;
+    unsigned int added = root->seed(book, r, depth);
+    if (transpositions != NULL) {
+        rebuild_transpositions();
+    }
+    #ifdef DEBUG
+    if (!quiet) cout << "Added " << added << " nodes of the opening book." << endl;
+    #endif
+    return added;
+}
+
+void MCTS_tree::reclaim(MCTS_arena *arena, MCTS_garbage &garbage) {
+    /** Destructs the discarded nodes (and with them their subtrees), then releases the discarded blocks */
+    for (MCTS_node *node : garbage.nodes) {
+        node->~MCTS_node();
+    }
+    for (auto &block : garbage.blocks) {
+        arena->release(block.first, block.second);
+    }
 }
 
 const MCTS_state *MCTS_tree::get_current_state() const { return root->get_current_state(); }
@@ -269,13 +1785,156 @@ MCTS_node *MCTS_tree::select_best_child() {
     return root->select_best_child(0.0);
 }
 
-void MCTS_tree::print_stats() const { root->print_stats(); }
+MCTS_search_stats MCTS_tree::get_search_stats() const {
+    /** All zeros unless compiled with SEARCH_STATS */
+    MCTS_search_stats out;
+    const MCTS_search_counters &c = arena->stats;
+    out.seconds = c.search_ns * 1e-9;
+    out.iterations = c.iterations;
+    out.selections = c.selections;
+    out.selection_depth = c.selection_depth;
+    out.max_selection_depth = c.max_selection_depth;
+    out.selection_seconds = c.selection_ns * 1e-9;
+    out.expansions = c.expansions;
+    out.expansion_seconds = c.expansion_ns * 1e-9;
+    out.generation_seconds = c.generation_ns * 1e-9;
+    out.next_state_seconds = c.next_state_ns * 1e-9;
+    out.rollouts = c.rollouts;
+    out.rollout_plies = c.rollout_plies;
+    out.rollout_seconds = c.rollout_ns * 1e-9;
+    out.backpropagations = c.backpropagations;
+    out.backpropagation_seconds = c.backpropagation_ns * 1e-9;
+    out.solved_visits = c.solved_visits;
+    out.evaluations = c.evaluations;
+    out.evaluation_batches = c.evaluation_batches;
+    out.evaluation_seconds = c.evaluation_ns * 1e-9;
+    if (search_scheduler != NULL) {
+        SchedulerStats s = search_scheduler->get_stats();
+        out.scheduler_jobs = s.jobs;
+        out.scheduler_lock_acquisitions = s.lock_acquisitions;
+        out.scheduler_queue_wait_seconds = s.queue_wait_ns * 1e-9;
+        out.scheduler_lock_hold_seconds = s.lock_hold_ns * 1e-9;
+    }
+    return out;
+}
+
+void MCTS_tree::reset_search_stats() {
+    arena->stats.reset();
+    if (search_scheduler != NULL) search_scheduler->reset_stats();
+}
+
+void MCTS_tree::print_stats() const {
+    root->print_stats();
+    #ifdef SEARCH_STATS
+    get_search_stats().print();
+    #endif
+    cout << "Tree memory: " << arena->get_memory_usage() / 1024 << " KB in use";
+    if (arena->get_budget() > 0) cout << " (budget " << arena->get_budget() / 1024 << " KB)";
+    cout << ", " << get_node_memory() / 1024 << " KB of node slabs reserved" << endl;
+    if (transpositions != NULL && transposition_lookups > 0) {
+        cout << "Transpositions: " << transposition_hits << " / " << transposition_lookups << " new nodes were shared ("
+             << setprecision(4) << 100.0 * transposition_hits / transposition_lookups << "%)" << endl;
+    }
+}
+
+
+/*** Time management ***/
+bool MCTS_deadline::poll() {
+    /** Reading the clock can cost as much as a cheap iteration so it is only read every interval calls. The interval is
+     * chosen so that reads are about DEADLINE_CHECK_PERIOD apart (never further apart than what is left), which bounds
+     * how late we notice the deadline: by that period plus one iteration. An interrupt is noticed after the iteration. */
+    if (interrupted()) return true;
+    if (--countdown > 0) return false;
+    clock::time_point now = clock::now();
+    if (now >= end) return true;
+    double per_iteration = chrono::duration<double>(now - last_check).count() / interval;
+    double next_check = min(DEADLINE_CHECK_PERIOD, chrono::duration<double>(end - now).count());
+    double next_interval = (per_iteration > 0.0) ? next_check / per_iteration : DEADLINE_MAX_CHECK_INTERVAL;
+    interval = (next_interval < 1.0) ? 1 : (next_interval > DEADLINE_MAX_CHECK_INTERVAL) ? DEADLINE_MAX_CHECK_INTERVAL : (unsigned int) next_interval;
+    countdown = interval;
+    last_check = now;
+    return false;
+}
+
+double MCTS_time_manager::budget(unsigned int expected_moves_left, double importance) const {
+    /** An equal share of the remaining clock for each of the moves we expect to play (plus the increment we get back),
+     * scaled by how much this move matters and capped by the per-move limit */
+    double available = remaining - TIME_SAFETY_MARGIN;
+    if (available <= 0.0) return 0.0;
+    double share = available / max(expected_moves_left, 1u) * importance + increment;
+    return min(min(share, available), max_move_time);
+}
+
+double MCTS_time_manager::think(MCTS_tree *tree, int max_iter, unsigned int expected_moves_left, double importance,
+                                unsigned int number_of_threads, search_mode mode) {
+    /** Grows the tree in slices of TIME_SLICE * budget and looks at the root's statistics in between. The slices search
+     * quietly: progress is reported once for the whole move. */
+    tree->stop_pondering();     // (!) before we look at the root
+    MCTS_deadline move_clock(1e9);
+    const bool quiet = tree->quiet;
+    #ifdef DEBUG
+    if (!quiet) cout << "Growing tree..." << endl;
+    #endif
+    tree->quiet = true;
+    int made = 0;
+    double soft = budget(expected_moves_left, importance);
+    double hard = min(min(soft * TIME_MAX_EXTENSION, max_move_time), max(remaining - TIME_SAFETY_MARGIN, 0.0));
+    const MCTS_node *root = tree->root;
+    unsigned int start_simulations = root->number_of_simulations;
+    const MCTS_node *previous_most_visited = NULL;
+    while (max_iter > 0) {
+        double elapsed = move_clock.elapsed();
+        if (elapsed >= hard || root->is_proven()) break;     // (a solved root is not searched any more)
+        int iterations = tree->grow_tree(max_iter, min(soft * TIME_SLICE, hard - elapsed), number_of_threads, mode);
+        max_iter -= iterations;
+        made += iterations;
+        // the most visited and the second most visited root moves
+        const MCTS_node *most_visited = NULL;
+        unsigned int first = 0, second = 0;
+        for (unsigned int i = 0 ; i < root->number_of_children ; i++) {
+            const MCTS_node *child = root->child(i);
+            if (!child->ready) continue;
+            unsigned int visits = child->resolve()->number_of_simulations;
+            if (visits > first) {
+                second = first;
+                first = visits;
+                most_visited = child;
+            } else if (visits > second) {
+                second = visits;
+            }
+        }
+        if (most_visited == NULL) continue;
+        if (root->number_of_children == 1 && root->is_fully_expanded()) break;     // only one move: nothing to think about
+        elapsed = move_clock.elapsed();
+        if (elapsed < soft) {
+            // stop early if the second best cannot catch up before the budget runs out, even if it got every simulation
+            double rate = (root->number_of_simulations - start_simulations) / elapsed;
+            if (first - second > rate * (soft - elapsed)) break;
+        } else {
+            // out of budget: only keep going if the root is unstable
+            bool stable = most_visited == previous_most_visited && most_visited == root->select_best_child(0.0);
+            if (stable) break;
+        }
+        previous_most_visited = most_visited;
+    }
+    tree->quiet = quiet;
+    double spent = move_clock.elapsed();
+    remaining += increment - spent;
+    #ifdef DEBUG
+    if (!quiet) {
+        cout << "Time manager: made " << made << " iterations in " << setprecision(3) << spent << "s of a " << soft << "s budget, "
+             << remaining << "s left on the clock" << endl;
+    }
+    #endif
+    return spent;
+}
 
 
 /*** MCTS agent ***/
-MCTS_agent::MCTS_agent(MCTS_state *starting_state, int max_iter, int max_seconds)
-: max_iter(max_iter), max_seconds(max_seconds) {
-    tree = new MCTS_tree(starting_state);
+MCTS_agent::MCTS_agent(MCTS_state *starting_state, int max_iter, double max_seconds, unsigned int number_of_threads, search_mode mode,
+                       bool use_transpositions)
+: max_iter(max_iter), max_seconds(max_seconds), number_of_threads(number_of_threads), mode(mode), pondering(false) {
+    tree = new MCTS_tree(starting_state, use_transpositions);
 }
 
 const MCTS_move *MCTS_agent::genmove(const MCTS_move *enemy_move) {
@@ -290,7 +1949,7 @@ const MCTS_move *MCTS_agent::genmove(const MCTS_move *enemy_move) {
     cout << "___ DEBUG ______________________" << endl
          << "Growing tree..." << endl;
     #endif
-    tree->grow_tree(max_iter, max_seconds);
+    tree->grow_tree(max_iter, max_seconds, number_of_threads, mode);
     #ifdef DEBUG
     cout << "Tree size: " << tree->get_size() << endl
          << "________________________________" << endl;
@@ -302,6 +1961,9 @@ const MCTS_move *MCTS_agent::genmove(const MCTS_move *enemy_move) {
     }
     const MCTS_move *best_move = best_child->get_move();
     tree->advance_tree(best_move);
+    if (pondering) {
+        tree->start_pondering(max_iter, number_of_threads, mode);      // until the enemy's move arrives
+    }
     return best_move;
 }
 